@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# Loopback transfer benchmark: pushes a random file from client to server and
+# reports wall time and CPU-seconds per transferred GB for both ends.
+#
+# Usage: ./bench.sh [size in MB] [directory holding client/server] [port]
+# Point the second argument at another build (e.g. a worktree of an older
+# commit) to compare two transport loops on the same input. Flags in $FLAGS
+# are passed to both programs, e.g. FLAGS="-c cubic" ./bench.sh
+
+SIZE_MB=${1:-100}
+BIN=${2:-.}
+PORT=${3:-8080}
+
+IN=$(mktemp)
+OUT=$(mktemp)
+CLIENT_LOG=$(mktemp)
+SERVER_LOG=$(mktemp)
+trap 'kill $SERVER $CLIENT 2> /dev/null; rm -f "$IN" "$OUT" "$CLIENT_LOG" "$SERVER_LOG"' EXIT
+
+head -c $((SIZE_MB * 1024 * 1024)) /dev/urandom > "$IN"
+BYTES=$(stat -c %s "$IN")
+
+# utime + stime of a process, in seconds
+function cpu_seconds() {
+    awk -v hz="$(getconf CLK_TCK)" '{ print ($14 + $15) / hz }' "/proc/$1/stat"
+}
+
+"$BIN/server" $FLAGS "$PORT" < /dev/null > "$OUT" 2> "$SERVER_LOG" &
+SERVER=$!
+sleep 0.2
+START=$(date +%s.%N)
+"$BIN/client" $FLAGS localhost "$PORT" < "$IN" > /dev/null 2> "$CLIENT_LOG" &
+CLIENT=$!
+
+# Both programs run forever, so finish once every byte has arrived
+while [ "$(stat -c %s "$OUT")" -lt "$BYTES" ]; do
+    if ! kill -0 $SERVER $CLIENT 2> /dev/null; then
+        echo "Transfer aborted"
+        exit 1
+    fi
+    sleep 0.05
+done
+END=$(date +%s.%N)
+
+CLIENT_CPU=$(cpu_seconds $CLIENT)
+SERVER_CPU=$(cpu_seconds $SERVER)
+
+if ! cmp -s "$IN" "$OUT"; then
+    echo "Output differs from input"
+    exit 1
+fi
+
+awk -v b="$BYTES" -v s="$START" -v e="$END" -v c="$CLIENT_CPU" -v v="$SERVER_CPU" 'BEGIN {
+    gb = b / (1024 * 1024 * 1024)
+    printf "Transferred:  %d bytes in %.2f s (%.1f MB/s)\n", b, e - s, b / (e - s) / 1048576
+    printf "Client CPU:   %.2f s (%.2f s/GB)\n", c, c / gb
+    printf "Server CPU:   %.2f s (%.2f s/GB)\n", v, v / gb
+}'
+
+# SIGUSR1 makes each end print its transport counters, one JSON line per worker
+kill -USR1 $CLIENT $SERVER 2> /dev/null
+sleep 0.1
+echo "Client counters:"
+sed 's/^/    /' "$CLIENT_LOG"
+echo "Server counters:"
+sed 's/^/    /' "$SERVER_LOG"
@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# Compression benchmark: sends log-like text, a half-text half-random mix and
+# random data through proxy, with and without -z, and reports the effective
+# throughput (input bytes per second) against the compression ratio (input
+# bytes per payload byte sent).
+#
+# Usage: ./bench_compress.sh [size in MB]
+# $PROXY_FLAGS shapes the link, a 100 Mbit/s one by default so that the wire
+# is the bottleneck; flags in $FLAGS are passed to client and server. $PORT is
+# the proxy's port, as in bench_lib.sh.
+
+MB=${1:-20}
+PROXY_FLAGS=${PROXY_FLAGS--b 100 -q 10000}
+
+. ./bench_lib.sh
+BYTES=$((MB * 1024 * 1024))
+
+# Service logs: timestamps, a few levels and paths, varying numbers
+awk -v bytes=$BYTES 'BEGIN {
+    srand(1)
+    split("INFO INFO INFO WARN DEBUG ERROR", level, " ")
+    split("/api/v1/items /api/v1/users /healthz /api/v2/orders /static/app.js", path, " ")
+    for (n = 0; n < bytes; n += length(line) + 1) {
+        line = sprintf("2026-10-16T%02d:%02d:%02d.%03dZ %s worker-%d request_id=%08x path=%s status=%d latency_ms=%d",
+                       n / 3600000 % 24, n / 60000 % 60, n / 1000 % 60, n % 1000, level[int(rand() * 6) + 1],
+                       int(rand() * 8), int(rand() * 2^31), path[int(rand() * 5) + 1],
+                       rand() < 0.95 ? 200 : 500, int(rand() * rand() * 900))
+        print line
+    }
+}' | head -c $BYTES > "$DIR/logs"
+head -c $BYTES /dev/urandom > "$DIR/random"
+# Alternating 64 KB of each
+for i in $(seq 0 $((MB * 8 - 1))); do
+    tail -c +$((i * 65536 + 1)) "$DIR/logs" | head -c 65536
+    tail -c +$((i * 65536 + 1)) "$DIR/random" | head -c 65536
+done | head -c $BYTES > "$DIR/mixed"
+
+echo "Proxy: ${PROXY_FLAGS:-no impairments}"
+for DATA in logs mixed random; do
+    for MODE in plain lz; do
+        EXTRA=""
+        [ $MODE = lz ] && EXTRA="-z"
+        : > "$DIR/out"
+
+        start_proxy $PROXY_FLAGS
+        start_server $FLAGS $EXTRA "$SERVER_PORT" < /dev/null > "$DIR/out" 2> /dev/null
+        start_client $FLAGS $EXTRA localhost "$PORT" < "$DIR/$DATA" > /dev/null 2> "$DIR/client.log"
+        wait_for "$DIR/out" "$BYTES"
+        stop_all
+        check "$DIR/$DATA" "$DIR/out"
+
+        SENT=$(counter "$DIR/client.log" bytes_sent)
+        printf "%-6s %-5s %s  ratio %5s  %s\n" "$DATA" "$MODE" "$(timing "$BYTES")" \
+               "$(awk -v b="$BYTES" -v p="${SENT:-0}" 'BEGIN { printf "%.2f", p ? b / p : 0 }')" "$CHECK"
+    done
+done
+exit $FAILED
@@ -0,0 +1,47 @@
+#!/bin/bash
+
+# Full-duplex benchmark: pushes a random file from client to server alone,
+# then one each way at once, and reports the combined goodput of each run and
+# the packets each end sent, split into data packets, pure ACKs and ACKs that
+# rode on data.
+#
+# Usage: ./bench_duplex.sh [size in MB each way]
+# $PROXY_FLAGS, if set, routes the transfers through proxy with those
+# impairments, e.g. PROXY_FLAGS="-b 100 -D 5" for a 100 Mbit/s link each way;
+# otherwise they run over bare loopback, where both ends share the CPU. Flags
+# in $FLAGS are passed to client and server. $PORT is as in bench_lib.sh.
+
+SIZE_MB=${1:-100}
+
+. ./bench_lib.sh
+
+head -c $((SIZE_MB * 1024 * 1024)) /dev/urandom > "$DIR/up"
+head -c $((SIZE_MB * 1024 * 1024)) /dev/urandom > "$DIR/down"
+: > "$DIR/none"
+BYTES=$(stat -c %s "$DIR/up")
+
+echo "Proxy: ${PROXY_FLAGS:-none}"
+for MODE in one-way duplex; do
+    DOWN="$DIR/down"
+    [ $MODE = one-way ] && DOWN="$DIR/none"
+    EXPECT=$(stat -c %s "$DOWN")
+    : > "$DIR/up.out"
+    : > "$DIR/down.out"
+
+    start_optional_proxy
+    start_server $FLAGS "$SERVER_PORT" < "$DOWN" > "$DIR/up.out" 2> "$DIR/server.log"
+    start_client $FLAGS localhost "$PORT" < "$DIR/up" > "$DIR/down.out" 2> "$DIR/client.log"
+    wait_for "$DIR/up.out" "$BYTES" "$DIR/down.out" "$EXPECT"
+    stop_all
+    check "$DIR/up" "$DIR/up.out" "$DOWN" "$DIR/down.out"
+
+    printf "%-7s %d bytes: %s combined  %s\n" "$MODE" "$((BYTES + EXPECT))" "$(timing $((BYTES + EXPECT)))" "$CHECK"
+    for END_NAME in client server; do
+        LOG="$DIR/$END_NAME.log"
+        printf "  %-6s sent %7d packets: %7d data, %5d resent, %6d pure ACKs, %6d ACKs on data\n" \
+               "$END_NAME" "$(counter "$LOG" tx_packets)" "$(counter "$LOG" packets_sent)" \
+               "$(counter "$LOG" retransmits)" "$(counter "$LOG" acks_sent)" \
+               "$(counter "$LOG" acks_piggybacked)"
+    done
+done
+exit $FAILED
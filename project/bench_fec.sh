@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Forward error correction benchmark: sends random data through proxy at a
+# range of loss rates, with and without -f, and reports the throughput, the
+# client's p99 delivery time (from sending a packet to its ACK, which a loss
+# stretches by a round trip or a timeout unless a repair rebuilds it), its
+# retransmits and the repair packets sent and used.
+#
+# Usage: ./bench_fec.sh [size in MB] [loss rates...]
+# $PROXY_FLAGS is added to each run's -l, a 20 ms round trip by default, where a
+# resend costs the most. Flags in $FLAGS are passed to client and server.
+# $PORT is the proxy's port, as in bench_lib.sh.
+
+MB=${1:-5}
+shift
+LOSSES=${*:-0 0.01 0.03 0.1}
+PROXY_FLAGS=${PROXY_FLAGS--D 10}
+
+. ./bench_lib.sh
+BYTES=$((MB * 1024 * 1024))
+head -c $BYTES /dev/urandom > "$DIR/in"
+
+echo "Proxy: $PROXY_FLAGS"
+for LOSS in $LOSSES; do
+    for MODE in plain fec; do
+        EXTRA=""
+        [ $MODE = fec ] && EXTRA="-f"
+        : > "$DIR/out"
+
+        start_proxy -l "$LOSS" $PROXY_FLAGS
+        start_server $FLAGS $EXTRA "$SERVER_PORT" < /dev/null > "$DIR/out" 2> "$DIR/server.log"
+        start_client $FLAGS $EXTRA localhost "$PORT" < "$DIR/in" > /dev/null 2> "$DIR/client.log"
+        wait_for "$DIR/out" "$BYTES"
+        stop_all
+        check "$DIR/in" "$DIR/out"
+
+        printf "loss %-5s %-5s %s  p99 delivery %8d us  retransmits %6d  repairs %6d  rebuilt %6d  %s\n" \
+               "$LOSS" "$MODE" "$(timing "$BYTES")" "$(p99 "$DIR/client.log" delivery_us)" \
+               "$(counter "$DIR/client.log" retransmits)" "$(counter "$DIR/client.log" fec_repairs)" \
+               "$(counter "$DIR/server.log" fec_rebuilt)" "$CHECK"
+    done
+done
+exit $FAILED
@@ -0,0 +1,94 @@
+# Shared parts of the bench_*.sh scripts, which source this file and run from
+# the directory holding client, server and proxy. A run starts the proxy if
+# there is one, then the server and the client, waits for every byte to
+# arrive, has both ends print their counters and checks the output.
+#
+# $PORT is the port the client sends to; with the proxy, the server listens
+# on the next one.
+
+PORT=${PORT:-8080}
+FAILED=0
+
+DIR=$(mktemp -d)
+trap 'kill $PROXY $SERVER $CLIENT 2> /dev/null; rm -rf "$DIR"' EXIT
+
+# Start proxy on $PORT with impairments "$@", in front of the server
+function start_proxy() {
+    SERVER_PORT=$((PORT + 1))
+    ./proxy "$@" "$PORT" localhost "$SERVER_PORT" 2> /dev/null &
+    PROXY=$!
+}
+
+# start_proxy with $PROXY_FLAGS if set; otherwise the server takes $PORT
+function start_optional_proxy() {
+    SERVER_PORT=$PORT
+    PROXY=""
+    if [ -n "$PROXY_FLAGS" ]; then
+        start_proxy $PROXY_FLAGS
+    fi
+}
+
+# Start server or client with arguments "$@" and the caller's redirections
+# (stdin named again, or the shell gives a background job /dev/null); the
+# transfer is timed from the client's start
+function start_server() {
+    ./server "$@" <&0 &
+    SERVER=$!
+}
+function start_client() {
+    sleep 0.2
+    START=$(date +%s.%N)
+    ./client "$@" <&0 &
+    CLIENT=$!
+}
+
+# Both programs run forever, so a transfer is done once file $1 holds $2
+# bytes, $3 holds $4 and so on; sets END then
+function wait_for() {
+    while [ $# -gt 0 ]; do
+        while [ "$(stat -c %s "$1")" -lt "$2" ]; do
+            if ! kill -0 $PROXY $SERVER $CLIENT 2> /dev/null; then
+                echo "Transfer aborted"
+                exit 1
+            fi
+            sleep 0.02
+        done
+        shift 2
+    done
+    END=$(date +%s.%N)
+}
+
+# SIGUSR1 makes each end print its transport counters, one JSON line on
+# stderr, and SIGTERM once more as it exits
+function stop_all() {
+    kill -USR1 $CLIENT $SERVER 2> /dev/null
+    sleep 0.1
+    kill $CLIENT $SERVER $PROXY 2> /dev/null
+    wait 2> /dev/null
+}
+
+# Compare file $1 with $2, $3 with $4 and so on; sets CHECK, and FAILED on a
+# mismatch
+function check() {
+    CHECK=OK
+    while [ $# -gt 0 ]; do
+        if ! cmp -s "$1" "$2"; then
+            CHECK=MISMATCH
+            FAILED=1
+        fi
+        shift 2
+    done
+}
+
+# Counter or histogram p99 'name' from the last line an end printed to log $1
+function counter() {
+    grep -o "\"$2\":[0-9]*" "$1" | tail -1 | cut -d: -f2
+}
+function p99() {
+    grep -o "\"$2\":{[^}]*" "$1" | tail -1 | grep -o '"p99":[0-9]*' | cut -d: -f2
+}
+
+# Wall time and throughput of the last transfer, of $1 bytes
+function timing() {
+    awk -v b="$1" -v s="$START" -v e="$END" 'BEGIN { printf "%7.2f s %8.1f MB/s", e - s, b / (e - s) / 1048576 }'
+}
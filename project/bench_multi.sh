@@ -0,0 +1,69 @@
+#!/bin/bash
+
+# Multi-client loopback benchmark: runs 1, 8 and 64 concurrent clients against
+# one server in multi-client mode (-m) and reports aggregate throughput and
+# server CPU-seconds per GB, checking every client's output.
+#
+# Usage: ./bench_multi.sh [total size in MB] [server workers] [port]
+# The total is split evenly across the clients of each round. Flags in $FLAGS
+# are passed to both programs, as in bench.sh.
+
+TOTAL_MB=${1:-256}
+WORKERS=${2:-$(nproc)}
+PORT=${3:-8080}
+
+DIR=$(mktemp -d)
+trap 'kill $SERVER ${CLIENTS[*]} 2> /dev/null; rm -rf "$DIR"' EXIT
+
+function cpu_seconds() {
+    awk -v hz="$(getconf CLK_TCK)" '{ print ($14 + $15) / hz }' "/proc/$1/stat"
+}
+
+for N in 1 8 64; do
+    rm -rf "$DIR"/*
+    mkdir "$DIR/out"
+    head -c $((TOTAL_MB * 1024 * 1024 / N)) /dev/urandom > "$DIR/in"
+    BYTES=$(stat -c %s "$DIR/in")
+
+    ./server $FLAGS -m "$DIR/out" -w "$WORKERS" "$PORT" < /dev/null 2> /dev/null &
+    SERVER=$!
+    sleep 0.2
+    SERVER_CPU_START=$(cpu_seconds $SERVER)
+    START=$(date +%s.%N)
+    CLIENTS=()
+    for i in $(seq $N); do
+        ./client $FLAGS localhost "$PORT" < "$DIR/in" > /dev/null 2> /dev/null &
+        CLIENTS+=($!)
+    done
+
+    # Finish once every client's file holds all of its bytes
+    while true; do
+        DONE=0
+        for f in "$DIR"/out/*; do
+            [ -f "$f" ] && [ "$(stat -c %s "$f")" -ge "$BYTES" ] && DONE=$((DONE + 1))
+        done
+        [ $DONE -eq $N ] && break
+        if ! kill -0 $SERVER 2> /dev/null; then
+            echo "Server exited"
+            exit 1
+        fi
+        sleep 0.02
+    done
+    END=$(date +%s.%N)
+    SERVER_CPU_END=$(cpu_seconds $SERVER)
+
+    for f in "$DIR"/out/*; do
+        if ! cmp -s "$DIR/in" "$f"; then
+            echo "Output of $(basename "$f") differs from input"
+            exit 1
+        fi
+    done
+
+    awk -v n="$N" -v b="$((BYTES * N))" -v s="$START" -v e="$END" -v c0="$SERVER_CPU_START" -v c1="$SERVER_CPU_END" 'BEGIN {
+        printf "%2d clients: %d bytes in %.2f s (%.1f MB/s), server CPU %.2f s/GB\n",
+               n, b, e - s, b / (e - s) / 1048576, (c1 - c0) / (b / 1073741824)
+    }'
+
+    kill $SERVER ${CLIENTS[*]} 2> /dev/null
+    wait 2> /dev/null
+done
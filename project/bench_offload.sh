@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# Segmentation offload benchmark: runs bench.sh with UDP GSO/GRO and again
+# with -G, which turns both off, and prints the CPU-seconds per GB of each.
+#
+# Usage: ./bench_offload.sh [size in MB] [port]
+# Flags in $FLAGS are passed to both programs in both runs, e.g.
+# FLAGS="-M 8952" ./bench_offload.sh
+
+SIZE_MB=${1:-200}
+PORT=${2:-8080}
+
+for MODE in offload no-offload; do
+    EXTRA=""
+    [ $MODE = no-offload ] && EXTRA="-G"
+    RESULT=$(FLAGS="$FLAGS $EXTRA" ./bench.sh "$SIZE_MB" . "$PORT")
+    # The client's counters tell whether its kernel took the offload
+    echo "$MODE ($(echo "$RESULT" | grep -o '"gso":[a-z]*,"gro":[a-z]*' | head -1)):"
+    echo "$RESULT" | head -3 | sed 's/^/    /'
+done
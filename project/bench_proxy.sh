@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# Lossy-link benchmark: pushes random files of each given size from client to
+# server through proxy and reports throughput, the client's retransmission
+# ratio (packets resent per data packet sent) and whether the output matches
+# the input byte for byte.
+#
+# Usage: ./bench_proxy.sh [size in MB]... (default: 1 10 100 1024)
+# $PROXY_FLAGS sets the impairments (see ./proxy with no arguments); flags in
+# $FLAGS are passed to client and server, as in bench.sh. $PORT is the proxy's
+# port, as in bench_lib.sh.
+
+SIZES=${*:-1 10 100 1024}
+PROXY_FLAGS=${PROXY_FLAGS--l 0.01 -r 0.01 -d 0.005 -c 0.001}
+
+. ./bench_lib.sh
+
+echo "Proxy: ${PROXY_FLAGS:-no impairments}"
+for MB in $SIZES; do
+    head -c $((MB * 1024 * 1024)) /dev/urandom > "$DIR/in"
+    BYTES=$(stat -c %s "$DIR/in")
+    : > "$DIR/out"
+
+    start_proxy $PROXY_FLAGS
+    start_server $FLAGS "$SERVER_PORT" < /dev/null > "$DIR/out" 2> /dev/null
+    start_client $FLAGS localhost "$PORT" < "$DIR/in" > /dev/null 2> "$DIR/client.log"
+    wait_for "$DIR/out" "$BYTES"
+    stop_all
+    check "$DIR/in" "$DIR/out"
+
+    SENT=$(counter "$DIR/client.log" packets_sent)
+    RESENT=$(counter "$DIR/client.log" retransmits)
+    printf "%5d MB: %s  retransmitted %s%%  %s\n" "$MB" "$(timing "$BYTES")" \
+           "$(awk -v p="${SENT:-0}" -v r="${RESENT:-0}" 'BEGIN { printf "%.2f", p ? 100 * r / p : 0 }')" "$CHECK"
+done
+exit $FAILED
@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Threaded IO benchmark: pushes a random file from client to server with the
+# stdin/stdout work on the network loop and then on threads of their own (-T),
+# once into a file and once into a reader that drains stdout in 64 KB gulps
+# with a pause between them, and reports the throughput of each run next to
+# the client's p99 RTT and the server's p99 ACK delay, the tail latency a
+# stalled loop would show up in.
+#
+# Usage: ./bench_threads.sh [size in MB]
+# $PROXY_FLAGS, if set, routes the transfers through proxy with those
+# impairments; otherwise they run over bare loopback, where both ends and both
+# IO threads each share the CPUs there are. Flags in $FLAGS are passed to
+# client and server. $PORT is as in bench_lib.sh.
+
+SIZE_MB=${1:-100}
+
+. ./bench_lib.sh
+
+head -c $((SIZE_MB * 1024 * 1024)) /dev/urandom > "$DIR/in"
+BYTES=$(stat -c %s "$DIR/in")
+
+# A consumer that keeps falling behind, appending to file $1 until end of file
+# (where dd still succeeds, having read nothing)
+function slow_reader() {
+    local size=-1
+    while [ "$(stat -c %s "$1")" != "$size" ]; do
+        size=$(stat -c %s "$1")
+        dd bs=64k count=1 iflag=fullblock status=none >> "$1"
+        sleep 0.001
+    done
+}
+
+echo "CPUs: $(nproc), proxy: ${PROXY_FLAGS:-none}"
+for SINK in file slow; do
+    for MODE in loop threads; do
+        EXTRA=""
+        [ $MODE = threads ] && EXTRA="-T"
+        : > "$DIR/out"
+
+        start_optional_proxy
+        if [ $SINK = slow ]; then
+            start_server $FLAGS $EXTRA "$SERVER_PORT" < /dev/null 2> "$DIR/server.log" > >(slow_reader "$DIR/out")
+        else
+            start_server $FLAGS $EXTRA "$SERVER_PORT" < /dev/null > "$DIR/out" 2> "$DIR/server.log"
+        fi
+        start_client $FLAGS $EXTRA localhost "$PORT" < "$DIR/in" > /dev/null 2> "$DIR/client.log"
+        wait_for "$DIR/out" "$BYTES"
+        stop_all
+        check "$DIR/in" "$DIR/out"
+
+        printf "%-4s %-7s %s  p99 RTT %6d us  p99 ACK delay %6d us  %s\n" "$SINK" "$MODE" "$(timing "$BYTES")" \
+               "$(p99 "$DIR/client.log" rtt_us)" "$(p99 "$DIR/server.log" ack_delay_us)" "$CHECK"
+    done
+done
+exit $FAILED
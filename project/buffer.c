@@ -0,0 +1,385 @@
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "integrity.h"
+#include "lz.h"
+
+// Slots needed for a full window of half-sized packets, rounded up to a
+// power of two so that sequence numbers map onto slots across wrap-around
+static int window_slots(int window, int mss)
+{
+    int capacity = 64;
+    while (capacity < 2 * (window / mss) && capacity < (1 << 17))
+        capacity *= 2;
+    return capacity;
+}
+
+// Bytes each entry's packet takes in the storage
+static size_t entry_stride(int mss)
+{
+    return sizeof(packet) + sizeof(packet_ext) + mss;
+}
+
+// Allocate entries and storage for 'capacity' packets
+static void alloc_entries(sending_buffer_t *buf, int capacity)
+{
+    size_t stride = entry_stride(buf->mss);
+    buf->entries = malloc(capacity * sizeof(buffer_entry_t));
+    buf->storage = malloc(capacity * stride);
+    for (int i = 0; i < capacity; i++)
+        buf->entries[i].pkt = (packet *)(buf->storage + i * stride);
+    buf->mask = capacity - 1;
+}
+
+// Initialize the buffer
+void init_sending_buffer(sending_buffer_t *buf, uint32_t first_seq, int window, int mss)
+{
+    buf->mss = mss;
+    alloc_entries(buf, window_slots(window, mss));
+    buf->base = first_seq;
+    buf->next = first_seq;
+    buf->count = 0;
+    buf->total_payload = 0;
+    buf->window = window;
+    buf->sack_high = first_seq;
+}
+
+void free_sending_buffer(sending_buffer_t *buf)
+{
+    free(buf->entries);
+    free(buf->storage);
+    buf->entries = NULL;
+    buf->storage = NULL;
+}
+
+void grow_sending_buffer(sending_buffer_t *buf, int window)
+{
+    buf->window = window;
+    int capacity = window_slots(window, buf->mss);
+    if (capacity <= (int)buf->mask + 1)
+        return;
+
+    // Entries are keyed by seq & mask, so every one in flight moves
+    sending_buffer_t old = *buf;
+    alloc_entries(buf, capacity);
+    for (uint32_t seq = buf->base; seq != buf->next; seq++)
+    {
+        buffer_entry_t *from = &old.entries[seq & old.mask];
+        buffer_entry_t *to = &buf->entries[seq & buf->mask];
+        packet *pkt = to->pkt;
+        memcpy(pkt, from->pkt, sizeof(packet) + ntohs(from->pkt->length));
+        *to = *from;
+        to->pkt = pkt;
+    }
+    free_sending_buffer(&old);
+}
+
+bool can_send_packet(sending_buffer_t *buf, size_t payload_size)
+{
+    return buf->total_payload + (int)payload_size <= buf->window &&
+           (uint32_t)buf->count <= buf->mask;
+}
+
+packet *next_packet(sending_buffer_t *buf)
+{
+    return buf->entries[buf->next & buf->mask].pkt;
+}
+
+buffer_entry_t *add_packet(sending_buffer_t *buf, size_t payload_size)
+{
+    if (!can_send_packet(buf, payload_size))
+    {
+        return NULL;
+    }
+
+    // The packet is already in the sequence's slot
+    buffer_entry_t *entry = &buf->entries[buf->next & buf->mask];
+    seal_packet(entry->pkt);
+    entry->payload_len = payload_size;
+    entry->acked = false;
+    entry->retransmitted = false;
+    gettimeofday(&entry->sent, NULL);
+
+    buf->total_payload += payload_size;
+    buf->count++;
+    buf->next++;
+
+    return entry;
+}
+
+buffer_entry_t *find_packet(sending_buffer_t *buf, uint32_t seq)
+{
+    if (seq_lt(seq, buf->base) || !seq_lt(seq, buf->next))
+        return NULL;
+    return &buf->entries[seq & buf->mask];
+}
+
+void remove_acked_packets(sending_buffer_t *buf)
+{
+    while (buf->count > 0 && buf->entries[buf->base & buf->mask].acked)
+    {
+        buf->total_payload -= buf->entries[buf->base & buf->mask].payload_len;
+        buf->base++;
+        buf->count--;
+    }
+}
+
+int acknowledge_packets(sending_buffer_t *buf, uint32_t ack_number)
+{
+    // Old, duplicate and not-yet-sent ACK numbers release nothing
+    if (!seq_lt(buf->base, ack_number) || seq_lt(buf->next, ack_number))
+        return 0;
+
+    // Each packet is released once, so this is O(1) amortized per packet
+    int released = ack_number - buf->base;
+    while (buf->base != ack_number)
+    {
+        buf->total_payload -= buf->entries[buf->base & buf->mask].payload_len;
+        buf->base++;
+    }
+    buf->count -= released;
+    if (seq_lt(buf->sack_high, buf->base))
+        buf->sack_high = buf->base;
+    return released;
+}
+
+int sack_packets(sending_buffer_t *buf, uint32_t ack_number, const uint8_t *bitmap, size_t bytes)
+{
+    int marked = 0;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        for (uint8_t bits = bitmap[i]; bits; bits &= bits - 1)
+        {
+            uint32_t seq = ack_number + 1 + i * 8 + __builtin_ctz(bits);
+            buffer_entry_t *entry = find_packet(buf, seq);
+            if (!entry || entry->acked)
+                continue;
+            entry->acked = true;
+            marked++;
+            if (!seq_lt(seq, buf->sack_high))
+                buf->sack_high = seq + 1;
+        }
+    }
+    return marked;
+}
+
+void init_receiving_buffer(receiving_buffer_t *buf, uint32_t first_seq, int window, int mss)
+{
+    int capacity = window_slots(window, mss);
+
+    buf->mss = mss;
+    buf->data = malloc((size_t)capacity * mss);
+    buf->lengths = calloc(capacity, sizeof(uint16_t));
+    buf->present = calloc(capacity / 64, sizeof(uint64_t));
+    buf->lz = calloc(capacity / 64, sizeof(uint64_t));
+    buf->expanded = NULL;
+    buf->expanded_len = -1;
+    buf->lz_failed = 0;
+    buf->mask = capacity - 1;
+    buf->base = first_seq;
+    buf->next = first_seq;
+    buf->held = 0;
+    buf->window = window;
+}
+
+void free_receiving_buffer(receiving_buffer_t *buf)
+{
+    free(buf->data);
+    free(buf->lengths);
+    free(buf->present);
+    free(buf->lz);
+    free(buf->expanded);
+    buf->data = NULL;
+    buf->expanded = NULL;
+}
+
+static bool slot_present(receiving_buffer_t *buf, uint32_t seq)
+{
+    int slot = seq & buf->mask;
+    return buf->present[slot / 64] & (1ULL << (slot % 64));
+}
+
+static bool slot_lz(receiving_buffer_t *buf, int slot)
+{
+    return buf->lz[slot / 64] & (1ULL << (slot % 64));
+}
+
+void grow_receiving_buffer(receiving_buffer_t *buf, int window)
+{
+    buf->window = window;
+    int capacity = window_slots(window, buf->mss);
+    if (capacity <= (int)buf->mask + 1)
+        return;
+
+    // Slots are keyed by seq & mask, so every packet held moves to a new slot
+    uint8_t *data = malloc((size_t)capacity * buf->mss);
+    uint16_t *lengths = calloc(capacity, sizeof(uint16_t));
+    uint64_t *present = calloc(capacity / 64, sizeof(uint64_t));
+    uint64_t *lz = calloc(capacity / 64, sizeof(uint64_t));
+    uint32_t mask = capacity - 1;
+    for (uint32_t i = 0; i <= buf->mask; i++)
+    {
+        uint32_t seq = buf->base + i;
+        if (!slot_present(buf, seq))
+            continue;
+        int from = seq & buf->mask;
+        int to = seq & mask;
+        memcpy(data + (size_t)to * buf->mss, buf->data + (size_t)from * buf->mss, buf->lengths[from]);
+        lengths[to] = buf->lengths[from];
+        present[to / 64] |= 1ULL << (to % 64);
+        if (slot_lz(buf, from))
+            lz[to / 64] |= 1ULL << (to % 64);
+    }
+
+    free(buf->data);
+    free(buf->lengths);
+    free(buf->present);
+    free(buf->lz);
+    buf->data = data;
+    buf->lengths = lengths;
+    buf->present = present;
+    buf->lz = lz;
+    buf->mask = mask;
+}
+
+int receive_window(receiving_buffer_t *buf)
+{
+    int room = buf->window - buf->held;
+    return MAX(room, 0);
+}
+
+// Mark a slot whose payload was just copied in as present, and move 'next'
+// past the run it completes
+static void fill_slot(receiving_buffer_t *buf, int slot, uint16_t len, bool lz)
+{
+    buf->lengths[slot] = len;
+    buf->present[slot / 64] |= 1ULL << (slot % 64);
+    if (lz)
+        buf->lz[slot / 64] |= 1ULL << (slot % 64);
+    else
+        buf->lz[slot / 64] &= ~(1ULL << (slot % 64));
+
+    while (buf->next != buf->base + buf->mask + 1 && slot_present(buf, buf->next))
+    {
+        buf->held += buf->lengths[buf->next & buf->mask];
+        buf->next++;
+    }
+}
+
+int store_packet(receiving_buffer_t *buf, uint32_t seq, const packet *pkt)
+{
+    uint16_t len = data_length(pkt);
+    if (len > buf->mss)
+        return -1;
+    if (seq_lt(seq, buf->next) || seq - buf->base > buf->mask ||
+        slot_present(buf, seq))
+        return verify_packet(pkt) ? 0 : -1;
+
+    // Verify while copying into the slot; a corrupt packet leaves it free
+    int slot = seq & buf->mask;
+    if (!verify_copy(pkt, buf->data + (size_t)slot * buf->mss))
+        return -1;
+    fill_slot(buf, slot, len, pkt->flags & LZ);
+    return 1;
+}
+
+int store_data(receiving_buffer_t *buf, uint32_t seq, const uint8_t *data, size_t len, bool lz)
+{
+    if (len > (size_t)buf->mss)
+        return -1;
+    if (seq_lt(seq, buf->next) || seq - buf->base > buf->mask ||
+        slot_present(buf, seq))
+        return 0;
+
+    int slot = seq & buf->mask;
+    memcpy(buf->data + (size_t)slot * buf->mss, data, len);
+    fill_slot(buf, slot, len, lz);
+    return 1;
+}
+
+size_t sack_bitmap(receiving_buffer_t *buf, uint8_t *bitmap, size_t max_bytes)
+{
+    // Only slots inside the window can be occupied
+    int32_t beyond = buf->base + buf->mask - buf->next;
+    size_t bits = MIN((size_t)MAX(beyond, 0), max_bytes * 8);
+    size_t bytes = 0;
+    memset(bitmap, 0, max_bytes);
+    for (size_t i = 0; i < bits; i++)
+    {
+        if (slot_present(buf, buf->next + 1 + i))
+        {
+            bitmap[i / 8] |= 1 << (i % 8);
+            bytes = i / 8 + 1;
+        }
+    }
+    return bytes;
+}
+
+int deliver_packets(receiving_buffer_t *buf, void (*output)(void *, uint8_t *, size_t), void *ctx,
+                    size_t room)
+{
+    int delivered = 0;
+    while (buf->base != buf->next)
+    {
+        int first = buf->base & buf->mask;
+        uint8_t *run = buf->data + (size_t)first * buf->mss;
+        int slots = 1;
+        size_t bytes = buf->lengths[first];
+        if (slot_lz(buf, first))
+        {
+            // An LZ block goes out on its own, once there is room for all of
+            // it, and is expanded only once however long that takes
+            if (!buf->expanded)
+                buf->expanded = malloc(LZ_BLOCK);
+            if (buf->expanded_len < 0)
+            {
+                buf->expanded_len = lz_decompress(run, bytes, buf->expanded, LZ_BLOCK);
+                if (buf->expanded_len < 0)
+                {
+                    buf->lz_failed++;
+                    buf->expanded_len = 0;
+                }
+            }
+            run = buf->expanded;
+            bytes = buf->expanded_len;
+            if (bytes > room)
+                break;
+            buf->expanded_len = -1;
+        }
+        else
+        {
+            // Extend the run while each slot is full and the next one follows
+            // it in memory, so the whole run goes out as a single write
+            while (buf->lengths[first + slots - 1] == buf->mss &&
+                   (uint32_t)(first + slots) <= buf->mask &&
+                   buf->base + slots != buf->next && !slot_lz(buf, first + slots))
+            {
+                bytes += buf->lengths[first + slots];
+                slots++;
+            }
+
+            // Trim the run to what the output side can take right now
+            while (bytes > room && slots > 0)
+            {
+                slots--;
+                bytes -= buf->lengths[first + slots];
+            }
+            if (slots == 0)
+                break;
+        }
+
+        if (bytes > 0)
+            output(ctx, run, bytes);
+        room -= bytes;
+        for (int i = first; i < first + slots; i++)
+        {
+            buf->present[i / 64] &= ~(1ULL << (i % 64));
+            buf->held -= buf->lengths[i];
+        }
+        buf->base += slots;
+        delivered += slots;
+    }
+    return delivered;
+}
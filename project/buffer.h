@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+#include "consts.h"
+
+typedef struct
+{
+    packet *pkt;               // Full packet header + payload, in the buffer's storage
+    size_t payload_len;        // Actual number of payload bytes in this packet
+    bool acked;                // Cumulatively ACKed or SACKed
+    bool retransmitted;        // Sent more than once; no RTT sample (Karn)
+    struct timeval sent;       // When the packet was first sent
+    struct timeval resent;     // When it was last sent again, if it was
+} buffer_entry_t;
+
+// Ring of unacknowledged packets. The entry for sequence number s lives at
+// entries[s & mask], so ACKs and retransmissions never search the buffer.
+typedef struct
+{
+    buffer_entry_t *entries;
+    uint8_t *storage;  // One packet of up to 'mss' payload bytes per entry
+    int mss;
+    uint32_t mask;     // Ring capacity - 1; the capacity is a power of two
+    uint32_t base;     // Seq of the oldest unacknowledged packet
+    uint32_t next;     // Seq the next added packet will carry
+    int count;         // # of packets currently in the buffer
+    int total_payload; // Total payload bytes currently unacknowledged
+    int window;        // Most payload bytes allowed in flight
+    uint32_t sack_high; // One past the highest SACKed seq
+} sending_buffer_t;
+
+// Initialize the buffer for a window of 'window' bytes in packets of at most
+// 'mss' payload bytes, starting at 'first_seq'
+void init_sending_buffer(sending_buffer_t *buf, uint32_t first_seq, int window, int mss);
+
+// Release the buffer's storage
+void free_sending_buffer(sending_buffer_t *buf);
+
+// Set the window to 'window' bytes, moving to a larger ring if it needs more
+// entries. Entries move, so no pointer to one may be held across this call.
+void grow_sending_buffer(sending_buffer_t *buf, int window);
+
+// Check if adding a new packet with payload size 'payload_size' would exceed the window
+bool can_send_packet(sending_buffer_t *buf, size_t payload_size);
+
+// The storage for the packet carrying the buffer's next sequence number, to
+// build in place: payload read straight into it is sent, kept for
+// retransmission and released on ACK without ever being copied
+packet *next_packet(sending_buffer_t *buf);
+
+// Add the packet built in next_packet, 'payload_size' bytes of payload after
+// its packet_ext, if it has one, and seal it.
+// Returns its entry, or NULL if there's no room (either by payload or by number of entries).
+buffer_entry_t *add_packet(sending_buffer_t *buf, size_t payload_size);
+
+// Entry holding 'seq', or NULL if that packet is not in flight
+buffer_entry_t *find_packet(sending_buffer_t *buf, uint32_t seq);
+
+// Remove acknowledged packets from the front of the buffer to free up space.
+void remove_acked_packets(sending_buffer_t *buf);
+
+// Release every packet before the cumulative 'ack_number'.
+// Returns the number of packets released; ACKs outside the window release none.
+int acknowledge_packets(sending_buffer_t *buf, uint32_t ack_number);
+
+// Mark the packets a SACK bitmap reports as received. Bit i of 'bitmap'
+// (byte i / 8, bit i % 8) stands for seq 'ack_number' + 1 + i.
+// Returns the number of packets newly marked.
+int sack_packets(sending_buffer_t *buf, uint32_t ack_number, const uint8_t *bitmap, size_t bytes);
+
+// Reassembly window for incoming packets, keyed by sequence offset like the
+// sending buffer. Slot i owns data[i * mss], so a run of full-sized packets
+// sits contiguously in memory and is delivered with one write.
+typedef struct
+{
+    uint8_t *data;
+    int mss;           // Largest payload of a packet, the size of a slot
+    uint16_t *lengths; // Payload bytes held by each slot
+    uint64_t *present; // Bitmap of occupied slots
+    uint64_t *lz;      // Bitmap of slots holding an LZ block
+    uint8_t *expanded; // LZ_BLOCK bytes to expand one into, once needed
+    long expanded_len; // Bytes there, the block at 'base' expanded, or -1
+    int lz_failed;     // LZ blocks that did not expand, for the caller to count
+    uint32_t mask;     // Ring capacity - 1; the capacity is a power of two
+    uint32_t base;     // Seq of the oldest packet not yet delivered
+    uint32_t next;     // First missing seq, i.e. the cumulative ACK
+    int held;          // Payload bytes from 'base' to 'next', not yet delivered
+    int window;        // Most bytes held, delivered or not; grows when tuned
+} receiving_buffer_t;
+
+// Initialize the buffer for a window of 'window' bytes in packets of at most
+// 'mss' payload bytes, expecting 'first_seq'
+void init_receiving_buffer(receiving_buffer_t *buf, uint32_t first_seq, int window, int mss);
+
+// Release the buffer's storage
+void free_receiving_buffer(receiving_buffer_t *buf);
+
+// Raise the window to 'window' bytes, moving to a larger ring if it needs
+// more slots
+void grow_receiving_buffer(receiving_buffer_t *buf, int window);
+
+// Bytes the sender may still send beyond the cumulative ACK: the window less
+// what is waiting to be delivered
+int receive_window(receiving_buffer_t *buf);
+
+// Verify a received data packet, whose full sequence number is 'seq', and
+// store its payload. The copy out of the datagram is the verifying pass
+// itself: the datagram cannot land in its slot, whose seq is only known once
+// it has arrived, in a receive batch shared with other packets and peers.
+// Returns 1 if stored, 0 for intact duplicates and packets outside the window,
+// which are dropped, and -1 if the packet is corrupt or longer than the mss.
+// A packet flagged LZ is kept compressed until it is delivered.
+int store_packet(receiving_buffer_t *buf, uint32_t seq, const packet *pkt);
+
+// Store data verified along with the packet that carried it, as the first
+// payload riding on a SYN or SYN-ACK is, or rebuilt from others (fec.h); 'lz'
+// if it is an LZ block. Returns as store_packet.
+int store_data(receiving_buffer_t *buf, uint32_t seq, const uint8_t *data, size_t len, bool lz);
+
+// Build the SACK bitmap of packets held beyond the cumulative ACK, in the
+// format sack_packets reads, at most 'max_bytes' long.
+// Returns its length in bytes, 0 if nothing is held out of order.
+size_t sack_bitmap(receiving_buffer_t *buf, uint8_t *bitmap, size_t max_bytes);
+
+// Hand contiguous in-order data to 'output', at most 'room' bytes of it;
+// 'ctx' is passed through to every call. LZ blocks are expanded and handed
+// over one per call; one the output has no room for yet stays expanded until
+// it does. One that does not expand (corrupted past the integrity check)
+// delivers nothing and is counted in 'lz_failed'.
+// Returns the number of packets delivered.
+int deliver_packets(receiving_buffer_t *buf, void (*output)(void *, uint8_t *, size_t), void *ctx,
+                    size_t room);
@@ -0,0 +1,127 @@
+#include <math.h>
+#include <string.h>
+
+#include "cc.h"
+#include "consts.h"
+
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+static void reno_init(cc_state_t* cc, int mss) {
+    memset(cc, 0, sizeof(*cc));
+    cc->mss = mss;
+    cc->cwnd = mss;
+    cc->ssthresh = MAX_WINDOW;
+}
+
+static void reno_on_ack(cc_state_t* cc, int acked_bytes, long now) {
+    (void) now;
+    if (cc->cwnd < cc->ssthresh) {
+        // Slow start: one packet per packet acknowledged
+        cc->cwnd += acked_bytes;
+    } else {
+        // Congestion avoidance: one packet per window acknowledged
+        cc->cwnd += MAX(1, cc->mss * acked_bytes / cc->cwnd);
+    }
+    cc->cwnd = MIN(cc->cwnd, MAX_WINDOW);
+}
+
+static void reno_on_fast_retransmit(cc_state_t* cc, long now) {
+    (void) now;
+    cc->ssthresh = MAX(cc->cwnd / 2, 2 * cc->mss);
+    cc->cwnd = cc->ssthresh + DUP_ACKS * cc->mss;
+    cc->recovering = true;
+}
+
+static void reno_on_timeout(cc_state_t* cc, long now) {
+    (void) now;
+    cc->ssthresh = MAX(cc->cwnd / 2, 2 * cc->mss);
+    cc->cwnd = cc->mss;
+    cc->recovering = false;
+}
+
+// CUBIC (RFC 8312) grows the window along a cubic curve anchored at the
+// window where the last loss happened, independent of the RTT
+static void cubic_on_ack(cc_state_t* cc, int acked_bytes, long now) {
+    if (cc->cwnd < cc->ssthresh) {
+        reno_on_ack(cc, acked_bytes, now);
+        return;
+    }
+
+    if (cc->epoch_start == 0) {
+        cc->epoch_start = now;
+        double w = (double) cc->cwnd / cc->mss;
+        if (cc->w_max < w) {
+            cc->w_max = w;
+            cc->k = 0;
+        }
+    }
+
+    double t = (now - cc->epoch_start) / 1e6 - cc->k;
+    double target = (CUBIC_C * t * t * t + cc->w_max) * cc->mss;
+    if (target > cc->cwnd) {
+        // Close the gap to the curve over roughly one window of ACKs
+        cc->cwnd += MAX(1, (int) ((target - cc->cwnd) * acked_bytes / cc->cwnd));
+    } else {
+        cc->cwnd += MAX(1, cc->mss * acked_bytes / (100 * cc->cwnd));
+    }
+    cc->cwnd = MIN(cc->cwnd, MAX_WINDOW);
+}
+
+// Multiplicative decrease by beta, remembering where the loss happened
+static void cubic_reduce(cc_state_t* cc) {
+    double w = (double) cc->cwnd / cc->mss;
+    cc->w_max = w;
+    cc->k = cbrt(w * (1 - CUBIC_BETA) / CUBIC_C);
+    cc->epoch_start = 0;
+    cc->ssthresh = MAX((int) (cc->cwnd * CUBIC_BETA), 2 * cc->mss);
+}
+
+static void cubic_on_fast_retransmit(cc_state_t* cc, long now) {
+    (void) now;
+    cubic_reduce(cc);
+    cc->cwnd = cc->ssthresh + DUP_ACKS * cc->mss;
+    cc->recovering = true;
+}
+
+static void cubic_on_timeout(cc_state_t* cc, long now) {
+    (void) now;
+    cubic_reduce(cc);
+    cc->cwnd = cc->mss;
+    cc->recovering = false;
+}
+
+static const cc_ops_t algorithms[] = {
+    {"reno", reno_init, reno_on_ack, reno_on_fast_retransmit, reno_on_timeout},
+    {"cubic", reno_init, cubic_on_ack, cubic_on_fast_retransmit,
+     cubic_on_timeout},
+};
+
+static const cc_ops_t* selected = &algorithms[0];
+
+bool select_cc(const char* name) {
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++) {
+        if (strcmp(algorithms[i].name, name) == 0) {
+            selected = &algorithms[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const cc_ops_t* cc_ops() { return selected; }
+
+void cc_dup_ack(cc_state_t* cc) {
+    if (cc->recovering)
+        cc->cwnd = MIN(cc->cwnd + cc->mss, MAX_WINDOW);
+}
+
+void cc_partial_ack(cc_state_t* cc, int acked_bytes) {
+    int cwnd = cc->cwnd - acked_bytes + cc->mss;
+    cc->cwnd = MAX(cwnd, cc->mss);
+}
+
+void cc_recovered(cc_state_t* cc) {
+    cc->cwnd = cc->ssthresh;
+    cc->recovering = false;
+}
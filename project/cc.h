@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Congestion control state; all windows in bytes
+typedef struct {
+    int cwnd;         // Congestion window
+    int ssthresh;     // Slow start threshold
+    bool recovering;  // In fast recovery after a fast retransmit
+    double w_max;     // CUBIC: window (in packets) before the last reduction
+    double k;         // CUBIC: seconds for the curve to climb back to w_max
+    long epoch_start; // CUBIC: when the current growth epoch began, usec
+    int mss;          // Largest payload per packet; the unit windows grow by
+} cc_state_t;
+
+// A congestion control algorithm. Every hook is called by the transport with
+// the current time in usec where growth depends on it.
+typedef struct {
+    const char* name;
+    void (*init)(cc_state_t* cc, int mss);
+    // New data acknowledged outside of recovery
+    void (*on_ack)(cc_state_t* cc, int acked_bytes, long now);
+    // DUP_ACKS duplicate ACKs: fast retransmit, enter fast recovery
+    void (*on_fast_retransmit)(cc_state_t* cc, long now);
+    // Retransmission timer fired
+    void (*on_timeout)(cc_state_t* cc, long now);
+} cc_ops_t;
+
+// Select an algorithm by name ("reno" or "cubic"); false if unknown
+bool select_cc(const char* name);
+
+// The selected algorithm, Reno unless select_cc said otherwise
+const cc_ops_t* cc_ops();
+
+// Algorithm-independent parts of fast recovery (RFC 5681, with NewReno's
+// partial ACKs from RFC 6582): each further duplicate ACK inflates the window
+// by a packet, a partial ACK deflates it by what it acknowledged less a
+// packet, and the ACK past the recovery point deflates it back to ssthresh
+void cc_dup_ack(cc_state_t* cc);
+void cc_partial_ack(cc_state_t* cc, int acked_bytes);
+void cc_recovered(cc_state_t* cc);
@@ -9,8 +9,9 @@
 #include <unistd.h>
 
 int main(int argc, char** argv) {
-    if (argc < 3) {
-        fprintf(stderr, "Usage: client <hostname> <port> \n");
+    int arg = parse_options(argc, argv);
+    if (arg < 0 || argc - arg < 2) {
+        fprintf(stderr, "Usage: client [-c reno|cubic] [-k] [-S] [-E] [-G] [-P] [-z] [-f] [-T] [-M mss] [-t trace] <hostname> <port> \n");
         exit(1);
     }
 
@@ -22,13 +23,13 @@ int main(int argc, char** argv) {
     struct sockaddr_in server_addr;
     server_addr.sin_family = AF_INET; // use IPv4
     // Only supports localhost as a hostname, but that's all we'll test on
-    char* addr = strcmp(argv[1], "localhost") == 0 ? "127.0.0.1" : argv[1];
+    char* addr = strcmp(argv[arg], "localhost") == 0 ? "127.0.0.1" : argv[arg];
     server_addr.sin_addr.s_addr = inet_addr(addr);
     // Set sending port
-    int PORT = atoi(argv[2]);
+    int PORT = atoi(argv[arg + 1]);
     server_addr.sin_port = htons(PORT); // Big endian
 
-    init_io();
+    init_io(options.io_threads);
     listen_loop(sockfd, &server_addr, CLIENT, input_io, output_io);
 
     return 0;
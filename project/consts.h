@@ -4,22 +4,48 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-// Maximum payload size
+// Maximum payload size, unless both ends negotiate a larger one (up to
+// MSS_MAX, what fits in a UDP datagram with the headers) in the handshake
 #define MAX_PAYLOAD 1012
+#define MSS_MAX (65507 - 16)
+// Kernel socket buffers asked for when packets are larger than MAX_PAYLOAD
+// or leave in GSO runs
+#define SOCKET_BUFFER (4 << 20)
 
 // Retransmission time
 #define TV_DIFF(end, start)                                                    \
     (end.tv_sec * 1000000) - (start.tv_sec * 1000000) + end.tv_usec -          \
         start.tv_usec
-#define RTO 1000000
+#define RTO_INIT 1000000      // Before the first RTT sample
+#define SYN_RTO 250000        // First SYN or SYN-ACK timeout, doubling from there
+#define RTO_MIN 10000         // Floor for the adaptive timeout
+#define RTO_MAX 60000000      // Ceiling, backoff included
+#define RTO_GRANULARITY 1000  // Timer granularity added to the variance term
+#define CONN_IDLE 120000000   // -m: a connection whose peer is silent this long is closed
 #define MIN(a, b) (a > b ? b : a)
 #define MAX(c, d) (c > d ? c : d)
 
 // Window size
-#define MIN_WINDOW MAX_PAYLOAD
-#define MAX_WINDOW MAX_PAYLOAD * 40
+// Receive window advertised in 'win': autotuning grows it from the initial
+// size up to the most the 16-bit field can carry, or with EXT the most it can
+// carry shifted by WINDOW_SCALE
+#define RECV_WINDOW_PACKETS 16
+#define RECV_WINDOW_INIT (MAX_PAYLOAD * RECV_WINDOW_PACKETS)
+#define RECV_WINDOW_MAX 65535
+#define WINDOW_SCALE 8
+#define EXT_WINDOW_MAX (RECV_WINDOW_MAX << WINDOW_SCALE)
+// Most bytes in flight; the peer's window keeps it lower without EXT
+#define MAX_WINDOW EXT_WINDOW_MAX
 #define DUP_ACKS 3
+// Delayed ACKs: in-order data is acknowledged once ACK_EVERY packets of it
+// are waiting, or ACK_DELAY usec on; ACK_DELAY stays well below RTO_MIN. The
+// first QUICK_ACKS packets, and as many after any out of order, are ACKed
+// without delay, as a sender starting out or recovering has few in flight.
+#define ACK_EVERY 2
+#define ACK_DELAY 2000
+#define QUICK_ACKS 16
 
 // States
 #define SERVER 0
@@ -29,6 +55,15 @@
 #define SYN 0b001
 #define ACK 0b010
 #define PARITY 0b100
+#define CRC 0b1000 // 'unused' carries a folded CRC32C of the packet
+#define SACK 0b10000 // SYN: SACK supported. Pure ACK: payload is a SACK bitmap
+#define EXT 0b100000 // A packet_ext starts the payload. SYN: also syn_options
+#define LZ 0b1000000 // The payload is an LZ block (lz.h). SYN: LZ supported
+// SYN: FEC supported. Without ACK: a repair packet (fec.h). Pure ACK: the
+// payload starts with the loss rate the receiver sees, in 256ths
+#define FEC 0b10000000
+// Longest SACK bitmap, in bytes; bit i stands for seq ack + 1 + i
+#define SACK_BYTES 32
 
 // Diagnostic messages
 #define RECV 0
@@ -42,70 +77,126 @@ typedef struct {
     uint16_t ack;
     uint16_t length;
     uint16_t win;
-    uint16_t flags; // LSb 0 SYN, LSb 1 ACK, LSb 2 Parity
+    uint16_t flags; // LSb 0 SYN, LSb 1 ACK, LSb 2 Parity, LSb 3 CRC, LSb 4 SACK,
+                    // LSb 5 EXT, LSb 6 LZ, LSb 7 FEC
     uint16_t unused;
     uint8_t payload[0];
 } packet;
 
-// Bit counter
+// Header extension of connections that negotiated EXT, making seq and ack
+// 32 bits wide. It sits at the start of the payload and 'length' counts it,
+// so the integrity checks cover it like any payload.
+typedef struct {
+    uint16_t seq_hi;
+    uint16_t ack_hi;
+} packet_ext;
+
+// What a SYN or SYN-ACK with EXT carries after its packet_ext
+typedef struct {
+    uint8_t wscale; // 'win' in the sender's later packets is shifted by this
+    uint8_t reserved;
+    uint16_t mss;   // Largest payload the sender takes; 0 means MAX_PAYLOAD
+} syn_options;
+
+// Largest datagram with the default payload size
+#define MAX_PACKET (sizeof(packet) + sizeof(packet_ext) + MAX_PAYLOAD)
+
+// Bit counter, a 64-bit word at a time
 static inline int bit_count(packet* pkt) {
     uint8_t* bytes = (uint8_t*) pkt;
     int len = sizeof(packet) + MIN(MAX_PAYLOAD, ntohs(pkt->length));
     int count = 0;
+    int i = 0;
 
-    for (int i = 0; i < len; i++) {
-        uint8_t val = bytes[i];
-
-        while (val > 0) {
-            if (val & 1) {
-                count += 1;
-            }
-            val >>= 1;
-        }
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        count += __builtin_popcountll(word);
+    }
+    for (; i < len; i++) {
+        count += __builtin_popcount(bytes[i]);
     }
 
     return count;
 }
 
+// Serial-number comparison: true if sequence number a comes before b, which
+// stays correct when the 32-bit space wraps around
+static inline bool seq_lt(uint32_t a, uint32_t b) {
+    return (int32_t) (a - b) < 0;
+}
+
+// Bytes of packet_ext at the start of the payload
+static inline size_t ext_length(const packet* pkt) {
+    return pkt->flags & EXT ? sizeof(packet_ext) : 0;
+}
+
+// The payload proper, after any packet_ext, and its length
+static inline uint8_t* packet_data(packet* pkt) {
+    return pkt->payload + ext_length(pkt);
+}
+static inline uint16_t data_length(const packet* pkt) {
+    uint16_t len = ntohs(pkt->length);
+    return len > ext_length(pkt) ? len - ext_length(pkt) : 0;
+}
+
+// Seq and ack as sent: 32 bits with EXT, otherwise the 16 on the wire
+static inline uint32_t wire_seq(const packet* pkt) {
+    const packet_ext* ext = (const packet_ext*) pkt->payload;
+    return ntohs(pkt->seq) | (pkt->flags & EXT ? (uint32_t) ntohs(ext->seq_hi) << 16 : 0);
+}
+static inline uint32_t wire_ack(const packet* pkt) {
+    const packet_ext* ext = (const packet_ext*) pkt->payload;
+    return ntohs(pkt->ack) | (pkt->flags & EXT ? (uint32_t) ntohs(ext->ack_hi) << 16 : 0);
+}
+
+// A 16-bit sequence number widened to the 32-bit one closest to 'near'; with
+// EXT the packet carries all 32 bits
+static inline uint32_t unwrap_seq(const packet* pkt, uint32_t wire, uint32_t near) {
+    if (pkt->flags & EXT)
+        return wire;
+    return near + (int16_t) ((uint16_t) wire - (uint16_t) near);
+}
+
 // Helpers
 static inline void print(char* txt) {
     fprintf(stderr, "%s\n", txt);
 }
 
-static inline void print_diag(packet* pkt, int diag) {
-    switch (diag) {
-    case RECV:
-        fprintf(stderr, "RECV");
-        break;
-    case SEND:
-        fprintf(stderr, "SEND");
-        break;
-    case RTOS:
-        fprintf(stderr, "RTOS");
-        break;
-    case DUPS:
-        fprintf(stderr, "DUPS");
-        break;
-    }
-
-    bool syn = pkt->flags & SYN;
-    bool ack = pkt->flags & ACK;
-    bool parity = pkt->flags & PARITY;
-    fprintf(stderr, " %hu ACK %hu LEN %hu WIN %hu FLAGS ", ntohs(pkt->seq),
-            ntohs(pkt->ack), ntohs(pkt->length), ntohs(pkt->win));
-    if (!syn && !ack && !parity) {
-        fprintf(stderr, "NONE");
+// Print a packet's fields in the diagnostic text format, as one write to
+// 'out'. 'length' is the payload proper, without any packet_ext.
+static inline void fprint_diag_fields(FILE* out, int diag, uint32_t seq, uint32_t ack,
+                                      uint16_t length, uint16_t win, uint16_t flags) {
+    static const char* const names[] = {"RECV", "SEND", "RTOS", "DUPS"};
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%s %u ACK %u LEN %hu WIN %hu FLAGS ",
+                     names[diag & 3], seq, ack, length, win);
+    bool syn = flags & SYN;
+    bool ack_flag = flags & ACK;
+    bool parity = flags & PARITY;
+    bool crc = flags & CRC;
+    bool sack = flags & SACK;
+    bool ext = flags & EXT;
+    bool lz = flags & LZ;
+    bool fec = flags & FEC;
+    if (!syn && !ack_flag && !parity && !crc && !sack && !ext && !lz && !fec) {
+        n += snprintf(line + n, sizeof(line) - n, "NONE");
     } else {
-        if (syn) {
-            fprintf(stderr, "SYN ");
-        }
-        if (ack) {
-            fprintf(stderr, "ACK ");
-        }
-        if (parity) {
-            fprintf(stderr, "PARITY ");
-        }
+        n += snprintf(line + n, sizeof(line) - n, "%s%s%s%s%s%s%s%s", syn ? "SYN " : "",
+                      ack_flag ? "ACK " : "", parity ? "PARITY " : "",
+                      crc ? "CRC " : "", sack ? "SACK " : "", ext ? "EXT " : "",
+                      lz ? "LZ " : "", fec ? "FEC " : "");
     }
-    fprintf(stderr, "\n");
+    snprintf(line + n, sizeof(line) - n, "\n");
+    fputs(line, out);
+}
+
+// Print a packet in the diagnostic text format, as one write to 'out'
+static inline void fprint_diag(FILE* out, packet* pkt, int diag) {
+    fprint_diag_fields(out, diag, wire_seq(pkt), wire_ack(pkt), data_length(pkt),
+                       ntohs(pkt->win), pkt->flags);
+}
+static inline void print_diag(packet* pkt, int diag) {
+    fprint_diag(stderr, pkt, diag);
 }
 
@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fec.h"
+
+// dst ^= src, a word at a time
+static void xor_into(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, sizeof(a));
+        memcpy(&b, src + i, sizeof(b));
+        a ^= b;
+        memcpy(dst + i, &a, sizeof(a));
+    }
+    for (; i < len; i++)
+        dst[i] ^= src[i];
+}
+
+// XOR 'len' bytes into an accumulator holding '*size' bytes, zeros beyond
+static void accumulate(uint8_t* acc, size_t* size, const uint8_t* data, size_t len) {
+    xor_into(acc, data, MIN(len, *size));
+    if (len > *size) {
+        memcpy(acc + *size, data + *size, len - *size);
+        *size = len;
+    }
+}
+
+void fec_encoder_init(fec_encoder_t* e, int mss, bool ext) {
+    memset(e, 0, sizeof(*e));
+    e->ext = ext ? sizeof(packet_ext) : 0;
+    e->stride = (sizeof(packet) + e->ext + mss + 7) & ~(size_t) 7;
+    e->repairs = malloc(FEC_REPAIRS * e->stride);
+}
+
+void fec_encoder_free(fec_encoder_t* e) { free(e->repairs); }
+
+void fec_set_loss(fec_encoder_t* e, int loss) {
+    int k = FEC_GROUP_MAX;
+    while (k > FEC_BLOCK && loss * k > 128)
+        k /= 2;
+    e->k = loss > 0 ? k : 0;
+}
+
+packet* fec_encode(fec_encoder_t* e, uint32_t seq, const uint8_t* data, size_t len, bool lz,
+                   size_t* repair_len) {
+    packet* pkt = (packet*) (e->repairs + e->next * e->stride);
+    uint8_t* xor = pkt->payload + e->ext;
+
+    // Groups start on a multiple of their size, and a gap ends one
+    if (e->count > 0 && seq != e->first + e->count)
+        e->count = 0;
+    if (e->count == 0) {
+        if (e->k == 0 || seq % e->k != 0)
+            return NULL;
+        e->group_k = e->k;
+        e->first = seq;
+        e->size = 0;
+        e->group = (fec_header){.k = e->k};
+    }
+
+    accumulate(xor, &e->size, data, len);
+    e->group.lz ^= lz;
+    e->group.len ^= len;
+    if (++e->count < e->group_k)
+        return NULL;
+
+    e->count = 0;
+    e->next = (e->next + 1) % FEC_REPAIRS;
+    *repair_len = e->size;
+    return pkt;
+}
+
+void fec_decoder_init(fec_decoder_t* d, int mss, uint32_t first_seq) {
+    memset(d, 0, sizeof(*d));
+    d->data = malloc((size_t) FEC_BLOCKS * mss);
+    d->rebuilt = malloc(mss);
+    d->mss = mss;
+    d->highest = first_seq;
+    // A block that starts before the first seq is never closed
+    d->closed = first_seq + (FEC_BLOCK - first_seq % FEC_BLOCK) % FEC_BLOCK;
+}
+
+void fec_decoder_free(fec_decoder_t* d) {
+    free(d->data);
+    free(d->rebuilt);
+}
+
+static fec_block_t* block_of(fec_decoder_t* d, uint32_t seq) {
+    return &d->blocks[seq / FEC_BLOCK % FEC_BLOCKS];
+}
+
+static uint8_t* block_data(fec_decoder_t* d, fec_block_t* b) {
+    return d->data + (size_t) (b - d->blocks) * d->mss;
+}
+
+// Close every block FEC_LAG packets behind the highest seq, counting what
+// it lacks as lost. Returns whether that made a new estimate.
+static bool close_blocks(fec_decoder_t* d) {
+    bool estimate = false;
+    while (!seq_lt(d->highest, d->closed + FEC_BLOCK + FEC_LAG)) {
+        fec_block_t* b = block_of(d, d->closed);
+        uint8_t arrived = b->first == d->closed ? b->received & ~b->rebuilt : 0;
+        d->lost += FEC_BLOCK - __builtin_popcount(arrived);
+        d->packets += FEC_BLOCK;
+        d->closed += FEC_BLOCK;
+        if (d->packets >= FEC_SAMPLE) {
+            d->loss += ((double) d->lost / d->packets - d->loss) / 4;
+            d->packets = 0;
+            d->lost = 0;
+            estimate = true;
+        }
+    }
+    return estimate;
+}
+
+bool fec_received(fec_decoder_t* d, uint32_t seq, const uint8_t* data, size_t len, bool lz) {
+    if (!seq_lt(seq, d->highest))
+        d->highest = seq + 1;
+    bool estimate = close_blocks(d);
+
+    // A block's slot goes to the next one along, never back to an older one
+    uint32_t first = seq - seq % FEC_BLOCK;
+    fec_block_t* b = block_of(d, seq);
+    if (b->first != first) {
+        if (b->received && seq_lt(first, b->first))
+            return estimate;
+        *b = (fec_block_t){.first = first};
+    }
+    uint8_t bit = 1 << (seq % FEC_BLOCK);
+    if (b->received & bit)
+        return estimate;
+    b->received |= bit;
+    b->lz ^= lz;
+    b->len ^= len;
+    size_t size = b->size;
+    accumulate(block_data(d, b), &size, data, len);
+    b->size = size;
+    return estimate;
+}
+
+int fec_loss(fec_decoder_t* d) {
+    int loss = (int) (d->loss * 256 + 0.5);
+    return MIN(loss, 255);
+}
+
+long fec_rebuild(fec_decoder_t* d, uint32_t first, const fec_header* h, const uint8_t* repair,
+                 size_t len, uint32_t* seq, bool* lz) {
+    if (h->k == 0 || h->k % FEC_BLOCK != 0 || h->k > FEC_GROUP_MAX || first % h->k != 0 ||
+        len > (size_t) d->mss)
+        return -1;
+
+    // Every block of the group must be known, and all but one packet in
+    int received = 0;
+    fec_block_t* gap = NULL;
+    for (uint32_t s = first; s != first + h->k; s += FEC_BLOCK) {
+        fec_block_t* b = block_of(d, s);
+        if (b->first != s || b->size > len)
+            return -1;
+        received += __builtin_popcount(b->received);
+        if (b->received != (1 << FEC_BLOCK) - 1)
+            gap = b;
+    }
+    if (received != h->k - 1)
+        return -1;
+
+    memcpy(d->rebuilt, repair, len);
+    size_t length = h->len;
+    bool flag = h->lz & 1;
+    for (uint32_t s = first; s != first + h->k; s += FEC_BLOCK) {
+        fec_block_t* b = block_of(d, s);
+        xor_into(d->rebuilt, block_data(d, b), b->size);
+        length ^= b->len;
+        flag ^= b->lz & 1;
+    }
+    if (length > len)
+        return -1;
+    *seq = gap->first + __builtin_ctz(~gap->received);
+    *lz = flag;
+    gap->rebuilt |= 1 << (*seq % FEC_BLOCK);
+    return length;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "consts.h"
+
+// Forward error correction. The sender follows each group of 'k' data
+// packets, starting at a seq that is a multiple of k, with a repair packet:
+// FEC without ACK, the group's first seq, and after any packet_ext the XOR of
+// the group's payloads, each padded with zeros to the longest. Its fec_header
+// goes in the 'ack' and 'win' fields, which a packet without ACK has no other
+// use for, so a repair is never larger than the data it covers. A receiver
+// that is missing just one packet of the group XORs the repair with the
+// others to rebuild it, without waiting on a resend.
+//
+// The receiver keeps the XOR of each aligned block of FEC_BLOCK packets, so
+// a group of any multiple of FEC_BLOCK is checked against the blocks it
+// spans. Once the highest seq received is FEC_LAG packets past a block, the
+// block is closed, and each packet it is still missing, or only has
+// rebuilt, counts as lost; one that was merely reordered has come in by
+// then. The receiver reports the share lost in the first payload byte of
+// its pure ACKs, and sends one for each new estimate, so the report gets
+// through even while data carries all other ACKs. The sender picks 'k'
+// from it: about one loss in two groups, so a single repair covers most of
+// them, and no repairs at all while nothing is lost.
+
+#define FEC_BLOCK 4
+#define FEC_GROUP_MAX 32
+// Blocks the receiver keeps, a power of two: 1024 packets back
+#define FEC_BLOCKS 256
+// Repair packets being built or queued: one is reused FEC_REPAIRS groups on,
+// more packets than a send batch holds, so it has been sent by then
+#define FEC_REPAIRS 16
+// Packets closed per loss estimate
+#define FEC_SAMPLE 64
+// Reordering tolerated before a missing packet counts as lost; well short of
+// the FEC_BLOCKS * FEC_BLOCK packets kept
+#define FEC_LAG 8
+
+typedef struct {
+    uint8_t k;    // Data packets in the group
+    uint8_t lz;   // XOR of their LZ flags
+    uint16_t len; // XOR of their payload lengths
+} fec_header;
+
+// On the wire: 'len' as the ACK, 'k' and 'lz' as the window
+static inline uint16_t fec_win(const fec_header* h) { return h->k | h->lz << 8; }
+
+static inline fec_header fec_header_of(const packet* pkt) {
+    uint16_t win = ntohs(pkt->win);
+    return (fec_header){.k = win & 0xff, .lz = win >> 8, .len = ntohs(pkt->ack)};
+}
+
+typedef struct {
+    uint8_t* repairs; // FEC_REPAIRS packets of 'stride' bytes
+    size_t stride;
+    size_t ext;       // packet_ext bytes before each XOR
+    int next;         // Repair packet the next group builds
+    int k;            // Size of the groups started from now on, 0 for none
+    int group_k;      // Size of the group being built
+    uint32_t first;   // Its first seq
+    fec_header group; // and header
+    int count;        // Packets in it so far; 0 while there is none
+    size_t size;      // Its longest payload: bytes of XOR in the repair
+} fec_encoder_t;
+
+typedef struct {
+    uint32_t first;   // Seq of the block's first packet
+    uint8_t received; // Bitmap of its packets received
+    uint8_t rebuilt;  // and of those fec_rebuild put together
+    uint8_t lz;       // XOR of their LZ flags
+    uint16_t len;     // XOR of their payload lengths
+    uint16_t size;    // Bytes of XOR held; the rest are zeros
+} fec_block_t;
+
+typedef struct {
+    fec_block_t blocks[FEC_BLOCKS];
+    uint8_t* data;    // FEC_BLOCKS XORs of 'mss' bytes
+    uint8_t* rebuilt; // The last packet fec_rebuild put together
+    int mss;
+    uint32_t highest; // One past the highest seq received
+    uint32_t closed;  // First seq of the oldest block not yet closed
+    int packets;      // Closed since the last estimate,
+    int lost;         // and how many of those were lost
+    double loss;      // Smoothed share of packets lost
+} fec_decoder_t;
+
+void fec_encoder_init(fec_encoder_t* e, int mss, bool ext);
+void fec_encoder_free(fec_encoder_t* e);
+
+// Group size for the loss rate the receiver reports, in 256ths
+void fec_set_loss(fec_encoder_t* e, int loss);
+
+// Add data packet 'seq', sent for the first time with 'len' bytes of
+// 'data'. Once that completes a group, returns its repair packet with the
+// XOR in place, '*repair_len' bytes after room for a packet_ext, and the
+// header left to the caller, from 'first' and 'group'; otherwise NULL.
+packet* fec_encode(fec_encoder_t* e, uint32_t seq, const uint8_t* data, size_t len, bool lz,
+                   size_t* repair_len);
+
+void fec_decoder_init(fec_decoder_t* d, int mss, uint32_t first_seq);
+void fec_decoder_free(fec_decoder_t* d);
+
+// Account for data packet 'seq', just stored for the first time. Returns
+// whether that closed enough packets for a new loss estimate.
+bool fec_received(fec_decoder_t* d, uint32_t seq, const uint8_t* data, size_t len, bool lz);
+
+// Loss rate to report, in 256ths
+int fec_loss(fec_decoder_t* d);
+
+// Rebuild the one packet missing from the group of the repair packet whose
+// first seq is 'first', with header 'h' and 'len' bytes of XOR in 'repair'.
+// Returns its length, with the payload in d->rebuilt and '*seq' and '*lz'
+// set, or -1 if the group is not missing exactly one packet or the repair is
+// malformed.
+long fec_rebuild(fec_decoder_t* d, uint32_t first, const fec_header* h, const uint8_t* repair,
+                 size_t len, uint32_t* seq, bool* lz);
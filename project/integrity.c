@@ -0,0 +1,218 @@
+#include <string.h>
+
+#include "integrity.h"
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#include <nmmintrin.h>
+#endif
+
+static bool use_crc = false;
+
+void enable_crc() { use_crc = true; }
+
+// Software CRC32C table, reflected polynomial 0x82F63B78. Built before main
+// so that worker threads never race to fill it.
+static uint32_t crc_table[256];
+
+__attribute__((constructor)) static void init_crc_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static inline uint32_t crc_byte_sw(uint32_t crc, uint8_t b) {
+    return crc_table[(crc ^ b) & 0xff] ^ (crc >> 8);
+}
+
+// XOR-fold (and optionally copy) without a CRC. 64 bytes per step across four
+// SSE2 accumulators, which every x86-64 CPU has; 8 bytes per step elsewhere.
+static uint64_t fold_plain(uint8_t* dst, const uint8_t* src, size_t len) {
+    uint64_t x = 0;
+#if defined(__x86_64__)
+    __m128i a = _mm_setzero_si128(), b = a, c = a, d = a;
+    for (; len >= 64; len -= 64, src += 64) {
+        __m128i v0 = _mm_loadu_si128((const __m128i*) src);
+        __m128i v1 = _mm_loadu_si128((const __m128i*) src + 1);
+        __m128i v2 = _mm_loadu_si128((const __m128i*) src + 2);
+        __m128i v3 = _mm_loadu_si128((const __m128i*) src + 3);
+        if (dst) {
+            _mm_storeu_si128((__m128i*) dst, v0);
+            _mm_storeu_si128((__m128i*) dst + 1, v1);
+            _mm_storeu_si128((__m128i*) dst + 2, v2);
+            _mm_storeu_si128((__m128i*) dst + 3, v3);
+            dst += 64;
+        }
+        a = _mm_xor_si128(a, v0);
+        b = _mm_xor_si128(b, v1);
+        c = _mm_xor_si128(c, v2);
+        d = _mm_xor_si128(d, v3);
+    }
+    a = _mm_xor_si128(_mm_xor_si128(a, b), _mm_xor_si128(c, d));
+    x = (uint64_t) _mm_cvtsi128_si64(a) ^
+        (uint64_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(a, a));
+#endif
+    for (; len >= 8; len -= 8, src += 8) {
+        uint64_t w;
+        memcpy(&w, src, 8);
+        if (dst) {
+            memcpy(dst, &w, 8);
+            dst += 8;
+        }
+        x ^= w;
+    }
+    for (; len > 0; len--, src++) {
+        if (dst)
+            *dst++ = *src;
+        x ^= *src;
+    }
+    return x;
+}
+
+static uint64_t fold_crc_sw(uint8_t* dst, const uint8_t* src, size_t len,
+                            uint32_t* crc) {
+    uint64_t x = 0;
+    uint32_t c = *crc;
+    for (; len >= 8; len -= 8, src += 8) {
+        uint64_t w;
+        memcpy(&w, src, 8);
+        if (dst) {
+            memcpy(dst, &w, 8);
+            dst += 8;
+        }
+        x ^= w;
+        for (int i = 0; i < 8; i++)
+            c = crc_byte_sw(c, src[i]);
+    }
+    for (; len > 0; len--, src++) {
+        if (dst)
+            *dst++ = *src;
+        x ^= *src;
+        c = crc_byte_sw(c, *src);
+    }
+    *crc = c;
+    return x;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint64_t
+fold_crc_hw(uint8_t* dst, const uint8_t* src, size_t len, uint32_t* crc) {
+    uint64_t x = 0;
+    uint64_t c = *crc;
+    for (; len >= 8; len -= 8, src += 8) {
+        uint64_t w;
+        memcpy(&w, src, 8);
+        if (dst) {
+            memcpy(dst, &w, 8);
+            dst += 8;
+        }
+        x ^= w;
+        c = _mm_crc32_u64(c, w);
+    }
+    for (; len > 0; len--, src++) {
+        if (dst)
+            *dst++ = *src;
+        x ^= *src;
+        c = _mm_crc32_u8((uint32_t) c, *src);
+    }
+    *crc = (uint32_t) c;
+    return x;
+}
+
+static bool has_hw_crc() {
+    static int supported = -1;
+    if (supported < 0)
+        supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#endif
+
+// The integrity kernel: XOR-fold 'len' bytes, copying them to 'dst' if it is
+// non-NULL and advancing '*crc' if it is non-NULL, all in one pass
+static uint64_t fold(uint8_t* dst, const uint8_t* src, size_t len,
+                     uint32_t* crc) {
+    if (!crc)
+        return fold_plain(dst, src, len);
+#if defined(__x86_64__)
+    if (has_hw_crc())
+        return fold_crc_hw(dst, src, len, crc);
+#endif
+    return fold_crc_sw(dst, src, len, crc);
+}
+
+static inline bool odd_parity(uint64_t x) { return __builtin_parityll(x); }
+
+uint64_t xor_fold(const void* buf, size_t len) {
+    return fold(NULL, buf, len, NULL);
+}
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len) {
+    crc = ~crc;
+    fold(NULL, buf, len, &crc);
+    return ~crc;
+}
+
+// Seal with the payload either already in place (src == NULL) or copied in
+static void seal(packet* pkt, const uint8_t* src, size_t len) {
+    pkt->flags &= ~(PARITY | CRC);
+    pkt->unused = 0;
+    if (use_crc)
+        pkt->flags |= CRC;
+
+    uint32_t crc = ~0u;
+    uint32_t* crcp = use_crc ? &crc : NULL;
+    uint64_t x = fold(NULL, (uint8_t*) pkt, sizeof(packet) + ext_length(pkt), crcp);
+    if (src)
+        x ^= fold(packet_data(pkt), src, len, crcp);
+    else
+        x ^= fold(NULL, packet_data(pkt), len, crcp);
+
+    if (use_crc) {
+        crc = ~crc;
+        pkt->unused = (uint16_t) (crc ^ (crc >> 16));
+        x ^= pkt->unused;
+    }
+    if (odd_parity(x))
+        pkt->flags |= PARITY;
+}
+
+void seal_packet(packet* pkt) { seal(pkt, NULL, data_length(pkt)); }
+
+void seal_copy(packet* pkt, const uint8_t* payload, size_t len) {
+    seal(pkt, payload, len);
+}
+
+bool verify_copy(const packet* pkt, uint8_t* dst) {
+    size_t len = ntohs(pkt->length);
+    size_t ext = ext_length(pkt);
+    bool has_crc = pkt->flags & CRC;
+    if (len < ext)
+        return false;
+
+    // The CRC was taken over the header with 'unused' and PARITY cleared
+    packet header = *pkt;
+    header.flags &= ~PARITY;
+    header.unused = 0;
+
+    uint32_t crc = ~0u;
+    uint32_t* crcp = has_crc ? &crc : NULL;
+    uint64_t x = fold(NULL, (uint8_t*) &header, sizeof(packet), crcp);
+    x ^= fold(NULL, pkt->payload, ext, crcp);
+    x ^= fold(dst, pkt->payload + ext, len - ext, crcp);
+
+    // Put back what was cleared so the parity covers the packet as received
+    x ^= (uint16_t) (pkt->flags & PARITY) ^ pkt->unused;
+    if (odd_parity(x))
+        return false;
+
+    if (has_crc) {
+        crc = ~crc;
+        return pkt->unused == (uint16_t) (crc ^ (crc >> 16));
+    }
+    return true;
+}
+
+bool verify_packet(const packet* pkt) { return verify_copy(pkt, NULL); }
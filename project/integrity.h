@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "consts.h"
+
+// Packet integrity: the PARITY flag makes the number of 1 bits in a packet
+// even, and with CRC checks enabled the CRC flag marks a CRC32C of the packet
+// (folded to 16 bits) carried in 'unused'. Both are computed in a single pass
+// over the payload, which can double as the payload copy.
+
+// Add CRC32C to every packet sealed from now on
+void enable_crc();
+
+// Seal a packet whose header and payload are in place
+void seal_packet(packet* pkt);
+
+// Copy 'len' payload bytes into the packet, after any packet_ext (which must
+// be in place), and seal it, in one pass
+void seal_copy(packet* pkt, const uint8_t* payload, size_t len);
+
+// Check a received packet's parity and, if flagged, its CRC
+bool verify_packet(const packet* pkt);
+
+// Same, copying the payload after any packet_ext to 'dst' in the same pass.
+// 'dst' is clobbered even when the check fails.
+bool verify_copy(const packet* pkt, uint8_t* dst);
+
+// XOR of every 64-bit word of 'buf' (tail bytes folded into the low byte);
+// the parity of the result is the bit parity of the buffer
+uint64_t xor_fold(const void* buf, size_t len);
+
+// CRC32C (Castagnoli), using the SSE4.2 instruction when the CPU has it
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
@@ -1,18 +1,307 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-void init_io() {
+#include "io.h"
+#include "spsc.h"
+
+// Byte ring; 'head' is the oldest byte, 'len' the number held
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t head;
+    size_t len;
+} ring_t;
+
+static uint8_t in_data[INPUT_BUFFER];
+static uint8_t out_data[OUTPUT_BUFFER];
+static ring_t in_ring = {in_data, INPUT_BUFFER, 0, 0};
+static ring_t out_ring = {out_data, OUTPUT_BUFFER, 0, 0};
+static bool in_eof = false;
+// A write to stdout failed; set by either the caller or the writer thread
+static atomic_bool out_failed;
+
+// With threads, the same storage as rings between the reader thread and the
+// caller, and between the caller and the writer thread. The caller polls
+// in_ready and out_room; a thread that finds its ring full or empty parks
+// on in_room or out_ready until the caller wakes it.
+static bool threaded = false;
+static spsc_ring_t in_spsc, out_spsc;
+static int in_ready, in_room, out_ready, out_room; // eventfds
+static atomic_bool reader_parked, writer_parked;
+static atomic_bool reader_done; // stdin reached end of file
+// Output ring head as of the last flush_io. Output counts as pending until
+// flush_io sees it written, so the caller keeps waiting on out_room, and
+// comes back to deliver more, even when the writer empties the ring before
+// the caller looks.
+static size_t out_seen;
+
+// Describe the ring's free space (fill) or contents (!fill) as up to two
+// iovecs, split where the ring wraps
+static int ring_iov(ring_t* r, struct iovec* iov, bool fill) {
+    size_t start = fill ? (r->head + r->len) % r->size : r->head;
+    size_t bytes = fill ? r->size - r->len : r->len;
+    size_t first = bytes < r->size - start ? bytes : r->size - start;
+
+    iov[0] = (struct iovec){r->data + start, first};
+    iov[1] = (struct iovec){r->data, bytes - first};
+    return bytes == 0 ? 0 : (bytes > first ? 2 : 1);
+}
+
+// Move 'length' bytes between the ring and 'buf'
+static void ring_copy(ring_t* r, uint8_t* buf, size_t length, bool fill) {
+    struct iovec iov[2];
+    ring_iov(r, iov, fill);
+    for (int i = 0; i < 2 && length > 0; i++) {
+        size_t n = length < iov[i].iov_len ? length : iov[i].iov_len;
+        if (fill)
+            memcpy(iov[i].iov_base, buf, n);
+        else
+            memcpy(buf, iov[i].iov_base, n);
+        buf += n;
+        length -= n;
+    }
+}
+
+// Let a pipe on either end hold as much as our own buffer, so the process
+// on the other side runs further ahead between wakeups. (Data still has to
+// pass through user memory to be packetized and sealed, so splice would
+// not save a copy here.)
+static void grow_pipe(int fd, int size) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode))
+        fcntl(fd, F_SETPIPE_SZ, size);
+}
+
+// Tell the poller on 'fd' that something changed
+static void notify(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+// Clear 'fd' for the next notify
+static void drain(int fd) {
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0)
+        return;
+}
+
+// Block on 'fd' until unpark, unless 'ready' holds once 'parked' is set. The
+// other side publishes before it checks 'parked', so one of the two sees
+// the other's store and no wakeup is lost.
+static void park(int fd, atomic_bool* parked, bool (*ready)()) {
+    atomic_store(parked, true);
+    if (ready()) {
+        atomic_store(parked, false);
+        return;
+    }
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+}
+
+static void unpark(int fd, atomic_bool* parked) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(parked, memory_order_relaxed) && atomic_exchange(parked, false))
+        notify(fd);
+}
+
+static bool in_has_room() { return spsc_space(&in_spsc) > 0; }
+static bool out_has_data() { return spsc_readable(&out_spsc) > 0; }
+
+// Reader thread: fill the input ring straight from stdin
+static void* reader_main(void* arg) {
+    (void) arg;
+    while (true) {
+        struct iovec iov[2];
+        int n = spsc_fill_iov(&in_spsc, iov);
+        if (n == 0) {
+            park(in_room, &reader_parked, in_has_room);
+            continue;
+        }
+        ssize_t len = readv(STDIN_FILENO, iov, n);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0) {
+            atomic_store(&reader_done, true);
+            notify(in_ready);
+            return NULL;
+        }
+        spsc_produce(&in_spsc, len);
+        notify(in_ready);
+    }
+}
+
+// Writer thread: drain the output ring straight to stdout
+static void* writer_main(void* arg) {
+    (void) arg;
+    while (true) {
+        struct iovec iov[2];
+        int n = spsc_drain_iov(&out_spsc, iov);
+        if (n == 0) {
+            park(out_ready, &writer_parked, out_has_data);
+            continue;
+        }
+        ssize_t len = writev(STDOUT_FILENO, iov, n);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0) {
+            perror("stdout");
+            atomic_store(&out_failed, true);
+            notify(out_room);
+            return NULL;
+        }
+        spsc_consume(&out_spsc, len);
+        notify(out_room);
+    }
+}
+
+// Start the reader and writer threads, with stdin and stdout left blocking.
+// They block every signal, which the caller's thread handles.
+static void start_threads() {
+    threaded = true;
+    spsc_init(&in_spsc, in_data, INPUT_BUFFER);
+    spsc_init(&out_spsc, out_data, OUTPUT_BUFFER);
+    in_ready = eventfd(0, EFD_NONBLOCK);
+    out_room = eventfd(0, EFD_NONBLOCK);
+    in_room = eventfd(0, 0);
+    out_ready = eventfd(0, 0);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    pthread_t reader, writer;
+    pthread_create(&reader, NULL, reader_main, NULL);
+    pthread_create(&writer, NULL, writer_main, NULL);
+    pthread_detach(reader);
+    pthread_detach(writer);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void init_io(bool threads) {
+    if (threads) {
+        grow_pipe(STDIN_FILENO, INPUT_BUFFER);
+        grow_pipe(STDOUT_FILENO, OUTPUT_BUFFER);
+        start_threads();
+        return;
+    }
+
     int flags = fcntl(STDIN_FILENO, F_GETFL);
     flags |= O_NONBLOCK;
     fcntl(STDIN_FILENO, F_SETFL, flags);
+
+    flags = fcntl(STDOUT_FILENO, F_GETFL);
+    flags |= O_NONBLOCK;
+    fcntl(STDOUT_FILENO, F_SETFL, flags);
+
+    grow_pipe(STDIN_FILENO, INPUT_BUFFER);
+    grow_pipe(STDOUT_FILENO, OUTPUT_BUFFER);
 }
 
 ssize_t input_io(uint8_t* buf, size_t max_length) {
-    ssize_t len = read(STDIN_FILENO, buf, max_length);
-    return len > 0 ? len : 0;
+    if (threaded) {
+        // Clear in_ready only once the ring is found empty, then look again:
+        // data published since then comes with a fresh notify
+        size_t length = spsc_read(&in_spsc, buf, max_length);
+        if (length == 0) {
+            drain(in_ready);
+            length = spsc_read(&in_spsc, buf, max_length);
+        }
+        if (length > 0)
+            unpark(in_room, &reader_parked);
+        return length;
+    }
+
+    // A read error other than having nothing to read ends the input as end
+    // of file does, as it does for the reader thread
+    struct iovec iov[2];
+    int n = in_ring.len < max_length && !in_eof ? ring_iov(&in_ring, iov, true) : 0;
+    if (n > 0) {
+        ssize_t len = readv(STDIN_FILENO, iov, n);
+        if (len > 0)
+            in_ring.len += len;
+        else if (len == 0 || (errno != EAGAIN && errno != EINTR))
+            in_eof = true;
+    }
+
+    size_t length = max_length < in_ring.len ? max_length : in_ring.len;
+    ring_copy(&in_ring, buf, length, false);
+    in_ring.head = (in_ring.head + length) % in_ring.size;
+    in_ring.len -= length;
+    return length;
+}
+
+size_t output_io(uint8_t* buf, size_t length) {
+    if (threaded) {
+        length = spsc_write(&out_spsc, buf, length);
+        if (length > 0)
+            unpark(out_ready, &writer_parked);
+        return length;
+    }
+
+    length = length < output_room() ? length : output_room();
+    ring_copy(&out_ring, buf, length, true);
+    out_ring.len += length;
+    return length;
 }
 
-void output_io(uint8_t* buf, size_t length) {
-    write(STDOUT_FILENO, buf, length); 
+int input_fd() { return threaded ? in_ready : STDIN_FILENO; }
+
+int output_fd() { return threaded ? out_room : STDOUT_FILENO; }
+
+short output_events() { return threaded ? POLLIN : POLLOUT; }
+
+bool input_eof() {
+    if (threaded)
+        return atomic_load(&reader_done) && spsc_readable(&in_spsc) == 0;
+    return in_eof && in_ring.len == 0;
+}
+
+size_t input_buffered() { return threaded ? spsc_readable(&in_spsc) : in_ring.len; }
+
+size_t output_pending() {
+    if (threaded)
+        return atomic_load_explicit(&out_spsc.tail, memory_order_relaxed) - out_seen;
+    return out_ring.len;
+}
+
+bool output_failed() { return atomic_load(&out_failed); }
+
+size_t output_room() { return threaded ? spsc_space(&out_spsc) : out_ring.size - out_ring.len; }
+
+void flush_io() {
+    if (threaded) {
+        drain(out_room);
+        out_seen = atomic_load_explicit(&out_spsc.head, memory_order_acquire);
+        return;
+    }
+
+    struct iovec iov[2];
+    int n = ring_iov(&out_ring, iov, false);
+    if (n == 0)
+        return;
+
+    // Anything but a full pipe fails the output for good, as it does for the
+    // writer thread
+    ssize_t len = writev(STDOUT_FILENO, iov, n);
+    if (len > 0) {
+        out_ring.head = (out_ring.head + len) % out_ring.size;
+        out_ring.len -= len;
+    } else if (len < 0 && errno != EAGAIN && errno != EINTR && !output_failed()) {
+        perror("stdout");
+        atomic_store(&out_failed, true);
+    }
 }
@@ -1,13 +1,49 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
 
-// Initialize IO layer
-void init_io();
+// Read-ahead buffer for stdin and write-behind buffer for stdout
+#define INPUT_BUFFER (1 << 20)
+#define OUTPUT_BUFFER (1 << 20)
 
-// Get input from IO layer
+// Initialize IO layer. With 'threads', a reader thread moves stdin into the
+// read-ahead buffer and a writer thread moves the write-behind buffer to
+// stdout, blocking in read and write so the caller never does; the buffers
+// are then lock-free rings (spsc.h) and the calls below stay the same.
+void init_io(bool threads);
+
+// Get input from IO layer; served from the read-ahead buffer, which is
+// refilled with a single readv when it runs short
 ssize_t input_io(uint8_t* buf, size_t max_length);
 
-// Output to IO layer
-void output_io(uint8_t* buf, size_t length);
+// Output to IO layer; queued until the next flush_io. Takes at most
+// output_room() bytes and returns how many it took.
+size_t output_io(uint8_t* buf, size_t length);
+
+// Descriptors the transport waits on for stdin/stdout readiness, and the
+// poll events output_fd signals readiness with
+int input_fd();
+int output_fd();
+short output_events();
+
+// True once stdin has reached end of file and everything read was consumed
+bool input_eof();
+
+// Bytes read ahead from stdin and not yet handed out
+size_t input_buffered();
+
+// Bytes queued for stdout that have not been written yet, as of the last
+// flush_io
+size_t output_pending();
+
+// True once a write to stdout has failed; queued output will never drain
+bool output_failed();
+
+// Free space for output_io before data has to be refused
+size_t output_room();
+
+// Write as much queued output as stdout will take without blocking, with a
+// single writev; with threads, the writer thread does that on its own
+void flush_io();
@@ -0,0 +1,174 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "consts.h"
+#include "lz.h"
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash(uint32_t v) { return (v * 2654435761u) >> (32 - LZ_HASH_BITS); }
+
+// Bytes a count takes after its nibble
+static inline size_t length_bytes(size_t n) { return n < 15 ? 0 : (n - 15) / 255 + 1; }
+
+static size_t sequence_size(size_t literals, size_t match) {
+    size_t size = 1 + length_bytes(literals) + literals;
+    if (match > 0)
+        size += 2 + length_bytes(match - LZ_MIN_MATCH);
+    return size;
+}
+
+static uint8_t* put_length(uint8_t* op, size_t n) {
+    if (n < 15)
+        return op;
+    for (n -= 15; n >= 255; n -= 255)
+        *op++ = 255;
+    *op++ = n;
+    return op;
+}
+
+// Write 'literals' bytes from 'lit' and, unless 'match' is 0, a match of
+// that length 'offset' bytes back
+static uint8_t* put_sequence(uint8_t* op, const uint8_t* lit, size_t literals, size_t offset,
+                             size_t match) {
+    uint8_t* token = op++;
+    size_t extra = match > 0 ? match - LZ_MIN_MATCH : 0;
+    *token = MIN(literals, 15) << 4 | MIN(extra, 15);
+    op = put_length(op, literals);
+    memcpy(op, lit, literals);
+    op += literals;
+    if (match > 0) {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        op = put_length(op, extra);
+    }
+    return op;
+}
+
+// Length of the match between 'ip' and the earlier 'match', up to 'end'
+static size_t match_length(const uint8_t* ip, const uint8_t* match, const uint8_t* end) {
+    size_t n = LZ_MIN_MATCH;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (ip + n + 8 <= end) {
+        uint64_t diff = read64(ip + n) ^ read64(match + n);
+        if (diff)
+            return n + (__builtin_ctzll(diff) >> 3);
+        n += 8;
+    }
+#endif
+    while (ip + n < end && ip[n] == match[n])
+        n++;
+    return n;
+}
+
+size_t lz_compress(lz_encoder_t* enc, const uint8_t* src, size_t len, uint8_t* dst,
+                   size_t capacity, size_t* consumed) {
+    len = MIN(len, LZ_BLOCK);
+    const uint8_t* end = src + len;
+    const uint8_t* anchor = src; // First byte not yet in the block
+    const uint8_t* ip = src;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + capacity;
+
+    // Step further through input that keeps missing, as incompressible data
+    // is not worth hashing every byte of
+    unsigned misses = 0;
+    while (len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+        uint32_t seq = read32(ip);
+        uint32_t h = hash(seq);
+        uint32_t pos = ip - src;
+        uint32_t candidate = enc->table[h];
+        enc->table[h] = pos;
+        // Entries left by earlier blocks are just as likely to fail this
+        if (candidate >= pos || pos - candidate > 65535 || read32(src + candidate) != seq) {
+            ip += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+
+        size_t n = match_length(ip, src + candidate, end);
+        if (op + sequence_size(ip - anchor, n) > oend)
+            break;
+        op = put_sequence(op, anchor, ip - anchor, pos - candidate, n);
+        ip += n;
+        anchor = ip;
+    }
+
+    // End with as many of the remaining literals as still fit
+    size_t room = oend - op;
+    size_t fit = room > 0 ? room - 1 : 0;
+    size_t literals = MIN((size_t) (end - anchor), fit);
+    while (literals > 0 && sequence_size(literals, 0) > room)
+        literals--;
+    if (literals > 0) {
+        op = put_sequence(op, anchor, literals, 0, 0);
+        anchor += literals;
+    }
+    *consumed = anchor - src;
+    return op - dst;
+}
+
+// Add the bytes continuing a count of 15 to '*n'
+static bool get_length(const uint8_t** ip, const uint8_t* end, size_t* n) {
+    uint8_t b;
+    do {
+        if (*ip == end)
+            return false;
+        b = *(*ip)++;
+        *n += b;
+    } while (b == 255);
+    return true;
+}
+
+long lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* end = src + len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + capacity;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(&ip, end, &literals))
+            return -1;
+        if (literals > (size_t) (end - ip) || literals > (size_t) (oend - op))
+            return -1;
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return -1;
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t n = token & 15;
+        if (n == 15 && !get_length(&ip, end, &n))
+            return -1;
+        n += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - dst) || n > (size_t) (oend - op))
+            return -1;
+
+        // Overlapping matches repeat what they copy, so go byte by byte
+        const uint8_t* match = op - offset;
+        if (offset >= n) {
+            memcpy(op, match, n);
+            op += n;
+        } else {
+            while (n-- > 0)
+                *op++ = *match++;
+        }
+    }
+    return op - dst;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LZ77 block codec in the LZ4 mould: a block is a series of sequences, each a
+// token byte (literal count in the high nibble, match length - LZ_MIN_MATCH
+// in the low one, 15 meaning more follows in bytes of 255 and a last smaller
+// one), the literals, then a 16-bit little-endian offset back into the output
+// and any match length bytes. A block may end after either part.
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+// Most bytes one block expands to
+#define LZ_BLOCK 65536
+
+// Match finder state: positions of recently seen 4-byte strings. It never
+// needs clearing, as every candidate is checked against the input.
+typedef struct {
+    uint32_t table[1 << LZ_HASH_BITS];
+} lz_encoder_t;
+
+// Compress as much of 'src' (at most LZ_BLOCK bytes) as fits in 'capacity'
+// bytes of 'dst'. Sets '*consumed' to the input bytes the block stands for
+// and returns its length.
+size_t lz_compress(lz_encoder_t* enc, const uint8_t* src, size_t len, uint8_t* dst,
+                   size_t capacity, size_t* consumed);
+
+// Expand a block into at most 'capacity' bytes of 'dst'. Returns the length,
+// or -1 if the block is malformed or does not fit.
+long lz_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t capacity);
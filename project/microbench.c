@@ -0,0 +1,129 @@
+#include "buffer.h"
+#include "consts.h"
+#include "integrity.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Microbenchmarks for transport hot paths. Not part of the protocol build;
+// run with `make microbench && ./microbench`.
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Cost of one cumulative ACK while the sending buffer is kept full: every
+// iteration acknowledges the oldest packet and refills its slot. The sequence
+// space wraps many times over the run.
+static void bench_ack_processing() {
+    const int iterations = 5000000;
+
+    printf("ACK processing (cumulative, window kept full)\n");
+    for (int packets = 40; packets <= 40 * 256; packets *= 4) {
+        sending_buffer_t buf;
+        uint16_t seq = 65000;
+        init_sending_buffer(&buf, seq, packets * MAX_PAYLOAD, MAX_PAYLOAD);
+
+        // Packets are built in place, in the slot of their seq
+        while (can_send_packet(&buf, MAX_PAYLOAD)) {
+            packet* pkt = next_packet(&buf);
+            *pkt = (packet){.seq = htons(seq++), .length = htons(MAX_PAYLOAD)};
+            add_packet(&buf, MAX_PAYLOAD);
+        }
+
+        double start = now_ns();
+        for (int i = 0; i < iterations; i++) {
+            acknowledge_packets(&buf, buf.base + 1);
+            packet* pkt = next_packet(&buf);
+            *pkt = (packet){.seq = htons(seq++)};
+            add_packet(&buf, 0);
+        }
+        double elapsed = now_ns() - start;
+
+        printf("    window %6d packets: %6.1f ns per ACK\n", packets,
+               elapsed / iterations);
+        free_sending_buffer(&buf);
+    }
+}
+
+// The per-bit parity count and byte-XOR parity the transport used before
+// the integrity kernel, kept here as the baseline
+static int legacy_bit_count(packet* pkt) {
+    uint8_t* bytes = (uint8_t*) pkt;
+    int len = sizeof(packet) + MIN(MAX_PAYLOAD, ntohs(pkt->length));
+    int count = 0;
+
+    for (int i = 0; i < len; i++) {
+        uint8_t val = bytes[i];
+        while (val > 0) {
+            if (val & 1) {
+                count += 1;
+            }
+            val >>= 1;
+        }
+    }
+    return count;
+}
+
+static uint8_t legacy_compute_parity(const void* data, size_t total_bytes) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint8_t parity = 0;
+    for (size_t i = 0; i < total_bytes; i++) {
+        parity ^= bytes[i];
+    }
+    return parity;
+}
+
+// Integrity throughput over full-sized packets, in GB/s of packet bytes
+static void bench_integrity() {
+    static char src[sizeof(packet) + MAX_PAYLOAD];
+    static char dst[sizeof(packet) + MAX_PAYLOAD];
+    static uint8_t payload[MAX_PAYLOAD];
+    packet* pkt = (packet*) src;
+    packet* out = (packet*) dst;
+    const int iterations = 1000000;
+    const double bytes = (double) iterations * sizeof(src);
+    volatile uint64_t sink = 0;
+
+    for (size_t i = 0; i < sizeof(src); i++)
+        src[i] = (char) (i * 131 + 7);
+    pkt->length = htons(MAX_PAYLOAD);
+
+    printf("Integrity (%zu-byte packets)\n", sizeof(src));
+
+#define RUN(label, expr)                                                       \
+    do {                                                                       \
+        double start = now_ns();                                               \
+        for (int i = 0; i < iterations; i++) {                                 \
+            src[sizeof(packet) + (i & 511)] ^= 1;                              \
+            sink += (expr);                                                    \
+        }                                                                      \
+        printf("    %-34s %6.2f GB/s\n", label, bytes / (now_ns() - start));   \
+    } while (0)
+
+    RUN("legacy bit_count (per bit)", legacy_bit_count(pkt));
+    RUN("legacy compute_parity (per byte)",
+        legacy_compute_parity(pkt, sizeof(src)));
+    RUN("legacy both passes + memcpy", (memcpy(dst, src, sizeof(src)),
+                                        legacy_bit_count(pkt) +
+                                            legacy_compute_parity(pkt, sizeof(src))));
+    RUN("bit_count (word popcount)", bit_count(pkt));
+    RUN("xor_fold parity", xor_fold(pkt, sizeof(src)) & 1);
+    RUN("crc32c", crc32c(0, pkt, sizeof(src)));
+    RUN("seal_copy (parity)", (*out = *pkt, seal_copy(out, pkt->payload, MAX_PAYLOAD), out->flags));
+    RUN("verify_copy (parity)", verify_copy(out, payload));
+    enable_crc();
+    RUN("seal_copy (parity + CRC32C)", (*out = *pkt, seal_copy(out, pkt->payload, MAX_PAYLOAD), out->flags));
+#undef RUN
+    (void) sink;
+}
+
+int main() {
+    bench_ack_processing();
+    bench_integrity();
+    return 0;
+}
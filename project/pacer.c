@@ -0,0 +1,33 @@
+#include "pacer.h"
+#include "consts.h"
+
+void pacer_init(pacer_t* p) {
+    p->rate = 0;
+    p->tokens = 0;
+    p->burst = 0;
+    p->last = 0;
+}
+
+void pacer_set_rate(pacer_t* p, int cwnd, long srtt, bool slow_start, int mss) {
+    double gain = slow_start ? PACE_GAIN_SLOW_START : PACE_GAIN;
+    p->rate = gain * cwnd / MAX(srtt, 1);
+    p->burst = MAX(2.0 * mss, p->rate * PACE_QUANTUM);
+}
+
+long pacer_delay(pacer_t* p, int bytes, long now) {
+    if (p->rate <= 0)
+        return 0;
+    if (p->last > 0)
+        p->tokens = MIN(p->burst, p->tokens + (now - p->last) * p->rate);
+    else
+        p->tokens = p->burst;
+    p->last = now;
+    if (p->tokens >= bytes)
+        return 0;
+    return (long) ((bytes - p->tokens) / p->rate) + 1;
+}
+
+void pacer_spend(pacer_t* p, int bytes) {
+    if (p->rate > 0)
+        p->tokens -= bytes;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Token bucket pacer, all times in usec. Tokens are bytes, earned at 'rate'
+// and kept up to 'burst'; a packet may leave once its bytes are earned.
+// Spending early leaves the bucket in debt, paid off by the time the packet
+// is due, which is when SO_TXTIME tells the kernel to send it.
+typedef struct {
+    double rate;   // Bytes per usec; 0 (no RTT sample yet) sends unpaced
+    double tokens; // Bytes earned and not spent, negative while in debt
+    double burst;  // Most tokens kept, so an idle sender cannot save up a window
+    long last;     // When tokens were last earned
+} pacer_t;
+
+// The bucket holds at least this much time at the pacing rate, so wakeups
+// come no more often than this while the window is large
+#define PACE_QUANTUM 1000
+
+// Pacing gains over cwnd/SRTT: in slow start the window doubles each round
+// trip, so the rate must stay ahead of it
+#define PACE_GAIN_SLOW_START 2.0
+#define PACE_GAIN 1.25
+
+void pacer_init(pacer_t* p);
+
+// Pace a window of 'cwnd' bytes over one 'srtt', times the gain
+void pacer_set_rate(pacer_t* p, int cwnd, long srtt, bool slow_start, int mss);
+
+// Earn the tokens since the last call; returns the usec from 'now' until
+// 'bytes' are earned, 0 if they already are
+long pacer_delay(pacer_t* p, int bytes, long now);
+
+// Spend 'bytes', ahead of time if need be
+void pacer_spend(pacer_t* p, int bytes);
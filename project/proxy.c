@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Lossy link between client and server: relays UDP datagrams in both
+// directions, dropping, duplicating, corrupting, reordering and delaying
+// them at random and capping the bandwidth. The client is whoever last sent
+// to the listening port.
+
+#define MAX_DATAGRAM 65536
+#define HOLD_MAX 10000 // usec a reordered packet waits for one to overtake it
+
+enum { TO_SERVER, TO_CLIENT };
+
+typedef struct {
+    double loss;      // Probability a packet is dropped
+    double reorder;   // ... held back until the next one has passed it
+    double duplicate; // ... sent twice
+    double corrupt;   // ... gets one bit flipped
+    long delay;       // One-way delay, usec
+    long jitter;      // Added delay, uniform in [0, jitter], usec
+    double rate;      // Bandwidth cap per direction, bytes per usec; 0 is none
+    int queue;        // Packets waiting per direction beyond this are dropped
+} link_t;
+
+// A datagram on its way, released at 'time'
+typedef struct {
+    long time;
+    uint64_t order; // Breaks ties so equal times leave in arrival order
+    int dir;
+    size_t length;
+    uint8_t* data;
+} pending_t;
+
+typedef struct {
+    uint64_t forwarded, dropped, duplicated, corrupted, reordered, overflowed;
+} counters_t;
+
+static link_t link_config = {.queue = 1000};
+static counters_t counters[2];
+static int queued[2];        // Packets in the heap, per direction
+static long link_free[2];    // When the bandwidth cap lets the next one out
+static pending_t held[2];    // A packet held back for reordering, per direction
+static bool holding[2];
+
+static pending_t* heap;
+static int heap_count, heap_capacity;
+static uint64_t next_order;
+
+static volatile sig_atomic_t dump_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static double chance() { return rand() / (RAND_MAX + 1.0); }
+
+static bool before(const pending_t* a, const pending_t* b) {
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+static void heap_push(pending_t p) {
+    if (heap_count == heap_capacity) {
+        heap_capacity = heap_capacity ? 2 * heap_capacity : 256;
+        heap = realloc(heap, heap_capacity * sizeof(pending_t));
+    }
+    int i = heap_count++;
+    while (i > 0 && before(&p, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = p;
+    queued[p.dir]++;
+}
+
+static pending_t heap_pop() {
+    pending_t top = heap[0];
+    pending_t last = heap[--heap_count];
+    int i = 0;
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= heap_count)
+            break;
+        if (child + 1 < heap_count && before(&heap[child + 1], &heap[child]))
+            child++;
+        if (!before(&heap[child], &last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+    queued[top.dir]--;
+    return top;
+}
+
+// Put a packet on the link: it leaves after the delay and jitter, and no
+// sooner than the bandwidth cap allows after the one before it
+static void schedule(int dir, uint8_t* data, size_t length, long now) {
+    if (queued[dir] >= link_config.queue) {
+        counters[dir].overflowed++;
+        free(data);
+        return;
+    }
+    long jitter = link_config.jitter > 0 ? (long) (chance() * (link_config.jitter + 1)) : 0;
+    long time = now + link_config.delay + jitter;
+    if (link_config.rate > 0) {
+        long start = link_free[dir] > now ? link_free[dir] : now;
+        link_free[dir] = start + (long) (length / link_config.rate);
+        if (link_free[dir] + link_config.delay > time)
+            time = link_free[dir] + link_config.delay;
+    }
+    heap_push((pending_t){time, next_order++, dir, length, data});
+}
+
+// Apply the impairments to one datagram read from either side
+static void on_datagram(int dir, const uint8_t* buf, size_t length, long now) {
+    if (chance() < link_config.loss) {
+        counters[dir].dropped++;
+        return;
+    }
+    int copies = chance() < link_config.duplicate ? 2 : 1;
+    if (copies == 2)
+        counters[dir].duplicated++;
+
+    for (int i = 0; i < copies; i++) {
+        uint8_t* data = malloc(length);
+        memcpy(data, buf, length);
+        if (length > 0 && chance() < link_config.corrupt) {
+            data[rand() % length] ^= 1 << (rand() % 8);
+            counters[dir].corrupted++;
+        }
+
+        if (!holding[dir] && chance() < link_config.reorder) {
+            held[dir] = (pending_t){now + HOLD_MAX, 0, dir, length, data};
+            holding[dir] = true;
+            counters[dir].reordered++;
+            continue;
+        }
+        schedule(dir, data, length, now);
+        if (holding[dir]) {
+            // Scheduled after the packet just queued, so it arrives behind it
+            holding[dir] = false;
+            schedule(dir, held[dir].data, held[dir].length, now);
+        }
+    }
+}
+
+static void print_counters() {
+    static const char* const names[] = {"client->server", "server->client"};
+    for (int dir = 0; dir < 2; dir++) {
+        counters_t* c = &counters[dir];
+        fprintf(stderr,
+                "%s: forwarded %lu dropped %lu duplicated %lu corrupted %lu "
+                "reordered %lu queue drops %lu\n",
+                names[dir], c->forwarded, c->dropped, c->duplicated, c->corrupted,
+                c->reordered, c->overflowed);
+    }
+}
+
+static void on_signal(int signum) {
+    if (signum == SIGUSR1)
+        dump_requested = 1;
+    else
+        stop_requested = 1;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: proxy [-l loss] [-r reorder] [-d duplicate] [-c corrupt] [-D delay ms]\n"
+            "             [-j jitter ms] [-b Mbit/s] [-q packets] [-s seed]\n"
+            "             <listen port> <server host> <server port>\n"
+            "Probabilities are in [0, 1]; -q bounds the queue of each direction.\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    unsigned seed = time(NULL);
+    int opt;
+    while ((opt = getopt(argc, argv, "l:r:d:c:D:j:b:q:s:")) != -1) {
+        switch (opt) {
+        case 'l': link_config.loss = atof(optarg); break;
+        case 'r': link_config.reorder = atof(optarg); break;
+        case 'd': link_config.duplicate = atof(optarg); break;
+        case 'c': link_config.corrupt = atof(optarg); break;
+        case 'D': link_config.delay = atof(optarg) * 1000; break;
+        case 'j': link_config.jitter = atof(optarg) * 1000; break;
+        case 'b': link_config.rate = atof(optarg) / 8; break;
+        case 'q': link_config.queue = atoi(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 10); break;
+        default: usage();
+        }
+    }
+    if (argc - optind != 3)
+        usage();
+    srand(seed);
+
+    struct sockaddr_in listen_addr = {0};
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_addr.s_addr = INADDR_ANY;
+    listen_addr.sin_port = htons(atoi(argv[optind]));
+
+    // Only supports localhost as a hostname, like the client
+    const char* host = argv[optind + 1];
+    struct sockaddr_in server_addr = {0};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr =
+        inet_addr(strcmp(host, "localhost") == 0 ? "127.0.0.1" : host);
+    server_addr.sin_port = htons(atoi(argv[optind + 2]));
+    struct sockaddr_in client_addr = {0};
+
+    // sockets[dir] receives what travels in direction 'dir': the first one
+    // faces the client, the second the server
+    int sockets[2];
+    sockets[TO_SERVER] = socket(AF_INET, SOCK_DGRAM, 0);
+    sockets[TO_CLIENT] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (bind(sockets[TO_SERVER], (struct sockaddr*) &listen_addr, sizeof(listen_addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+    int size = 4 << 20;
+    for (int i = 0; i < 2; i++) {
+        setsockopt(sockets[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(sockets[i], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+
+    struct sigaction sa = {.sa_handler = on_signal};
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    uint8_t buf[MAX_DATAGRAM];
+    while (!stop_requested) {
+        if (dump_requested) {
+            dump_requested = 0;
+            print_counters();
+        }
+
+        // Sleep until the next packet is due or a held one gives up waiting
+        long now = now_us();
+        long wake = -1;
+        if (heap_count > 0)
+            wake = heap[0].time;
+        for (int dir = 0; dir < 2; dir++) {
+            if (holding[dir] && (wake < 0 || held[dir].time < wake))
+                wake = held[dir].time;
+        }
+        struct timespec timeout = {0};
+        if (wake > now) {
+            timeout.tv_sec = (wake - now) / 1000000;
+            timeout.tv_nsec = (wake - now) % 1000000 * 1000;
+        }
+        struct pollfd fds[2] = {{sockets[TO_SERVER], POLLIN, 0}, {sockets[TO_CLIENT], POLLIN, 0}};
+        if (ppoll(fds, 2, wake < 0 ? NULL : &timeout, NULL) < 0)
+            continue;
+
+        now = now_us();
+        for (int dir = 0; dir < 2; dir++) {
+            if (!(fds[dir].revents & POLLIN))
+                continue;
+            while (true) {
+                struct sockaddr_in from;
+                socklen_t from_len = sizeof(from);
+                ssize_t n = recvfrom(sockets[dir], buf, sizeof(buf), MSG_DONTWAIT,
+                                     (struct sockaddr*) &from, &from_len);
+                if (n < 0)
+                    break;
+                if (dir == TO_SERVER)
+                    client_addr = from;
+                on_datagram(dir, buf, n, now);
+            }
+        }
+
+        for (int dir = 0; dir < 2; dir++) {
+            if (holding[dir] && held[dir].time <= now) {
+                holding[dir] = false;
+                schedule(dir, held[dir].data, held[dir].length, now);
+            }
+        }
+
+        while (heap_count > 0 && heap[0].time <= now) {
+            pending_t p = heap_pop();
+            struct sockaddr_in* to = p.dir == TO_SERVER ? &server_addr : &client_addr;
+            // Out through the socket facing the destination
+            int sockfd = sockets[p.dir == TO_SERVER ? TO_CLIENT : TO_SERVER];
+            if (to->sin_port != 0 &&
+                sendto(sockfd, p.data, p.length, 0, (struct sockaddr*) to, sizeof(*to)) >= 0)
+                counters[p.dir].forwarded++;
+            free(p.data);
+        }
+    }
+
+    print_counters();
+    return 0;
+}
@@ -0,0 +1,29 @@
+#include "rtt.h"
+#include "consts.h"
+
+void init_rtt(rtt_t* rtt) {
+    rtt->srtt = 0;
+    rtt->rttvar = 0;
+    rtt->rto = RTO_INIT;
+    rtt->sampled = false;
+}
+
+void rtt_sample(rtt_t* rtt, long sample) {
+    if (sample < 0)
+        return;
+
+    if (!rtt->sampled) {
+        rtt->srtt = sample;
+        rtt->rttvar = sample / 2;
+        rtt->sampled = true;
+    } else {
+        long err = rtt->srtt - sample;
+        rtt->rttvar += ((err < 0 ? -err : err) - rtt->rttvar) / 4;
+        rtt->srtt += (sample - rtt->srtt) / 8;
+    }
+
+    long rto = rtt->srtt + MAX(RTO_GRANULARITY, 4 * rtt->rttvar);
+    rtt->rto = MIN(RTO_MAX, MAX(RTO_MIN, rto));
+}
+
+void rtt_backoff(rtt_t* rtt) { rtt->rto = MIN(RTO_MAX, rtt->rto * 2); }
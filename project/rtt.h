@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Retransmission timeout estimator (Jacobson/Karels), all times in usec
+typedef struct {
+    long srtt;    // Smoothed round-trip time
+    long rttvar;  // Round-trip time variation
+    long rto;     // Current timeout, including any backoff
+    bool sampled; // Whether any RTT sample has been taken yet
+} rtt_t;
+
+// Start from RTO_INIT with no samples
+void init_rtt(rtt_t* rtt);
+
+// Fold in an RTT measured on a packet that was sent only once (Karn's rule);
+// this also clears any backoff
+void rtt_sample(rtt_t* rtt, long sample);
+
+// The retransmission timer fired: double the timeout
+void rtt_backoff(rtt_t* rtt);
@@ -8,10 +8,18 @@
 #include <unistd.h>
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: server <port>\n");
+    int arg = parse_options(argc, argv);
+    if (arg < 0 || argc - arg < 1) {
+        fprintf(stderr, "Usage: server [-c reno|cubic] [-k] [-S] [-E] [-G] [-P] [-z] [-f] [-T] [-M mss] [-t trace] [-m dir [-w workers]] <port>\n");
         exit(1);
     }
+    int PORT = atoi(argv[arg]);
+
+    // Any number of clients, each written to its own file
+    if (options.output_dir) {
+        serve_loop(PORT, options.workers);
+        return 0;
+    }
 
     /* Create sockets */
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -25,22 +33,16 @@ int main(int argc, char** argv) {
                     // same as inet_addr("0.0.0.0")
                     // "Address string to network bytes"
     // Set receiving port
-    int PORT = atoi(argv[1]);
     server_addr.sin_port = htons(PORT); // Big endian
 
     /* Let operating system know about our config */
     int did_bind =
         bind(sockfd, (struct sockaddr*) &server_addr, sizeof(server_addr));
 
-    struct sockaddr_in client_addr; // Same information, but about client
-    socklen_t s = sizeof(struct sockaddr_in);
-    char buffer;
-
-    // Wait for client connection
-    int bytes_recvd = recvfrom(sockfd, &buffer, sizeof(buffer), MSG_PEEK,
-                               (struct sockaddr*) &client_addr, &s);
+    // The client's address is learned from its SYN
+    struct sockaddr_in client_addr;
 
-    init_io();
+    init_io(options.io_threads);
     listen_loop(sockfd, &client_addr, SERVER, input_io, output_io);
 
     return 0;
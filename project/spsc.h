@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+
+// Lock-free single-producer/single-consumer byte ring. Only the producer
+// moves 'tail' and only the consumer moves 'head'; both count bytes ever
+// passed, so they never wrap in practice and tail - head is what is held.
+// Each sits on its own cache line, apart from the read-only fields, so one
+// side's stores do not keep invalidating the line the other side reads.
+#define CACHE_LINE 64
+
+typedef struct {
+    _Alignas(CACHE_LINE) _Atomic size_t tail; // Written by the producer
+    _Alignas(CACHE_LINE) _Atomic size_t head; // Written by the consumer
+    _Alignas(CACHE_LINE) uint8_t* data;
+    size_t size; // A power of two
+} spsc_ring_t;
+
+static inline void spsc_init(spsc_ring_t* r, uint8_t* data, size_t size) {
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->head, 0);
+    r->data = data;
+    r->size = size;
+}
+
+// Bytes held, as seen from either side
+static inline size_t spsc_readable(spsc_ring_t* r) {
+    return atomic_load_explicit(&r->tail, memory_order_acquire) -
+           atomic_load_explicit(&r->head, memory_order_acquire);
+}
+
+static inline size_t spsc_space(spsc_ring_t* r) { return r->size - spsc_readable(r); }
+
+// 'bytes' from position 'pos' as up to two iovecs, split where the ring wraps
+static inline int spsc_iov(spsc_ring_t* r, size_t pos, size_t bytes, struct iovec* iov) {
+    size_t start = pos & (r->size - 1);
+    size_t first = bytes < r->size - start ? bytes : r->size - start;
+    iov[0] = (struct iovec){r->data + start, first};
+    iov[1] = (struct iovec){r->data, bytes - first};
+    return bytes == 0 ? 0 : (bytes > first ? 2 : 1);
+}
+
+// Producer: the free space, to fill in place and then publish with
+// spsc_produce
+static inline int spsc_fill_iov(spsc_ring_t* r, struct iovec* iov) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    return spsc_iov(r, tail, spsc_space(r), iov);
+}
+
+static inline void spsc_produce(spsc_ring_t* r, size_t n) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+}
+
+// Consumer: the bytes held, to use in place and then release with
+// spsc_consume
+static inline int spsc_drain_iov(spsc_ring_t* r, struct iovec* iov) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    return spsc_iov(r, head, spsc_readable(r), iov);
+}
+
+static inline void spsc_consume(spsc_ring_t* r, size_t n) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+}
+
+// Copy up to 'length' bytes in (producer) or out (consumer); returns how many
+static inline size_t spsc_write(spsc_ring_t* r, const uint8_t* buf, size_t length) {
+    struct iovec iov[2];
+    int n = spsc_fill_iov(r, iov);
+    size_t done = 0;
+    for (int i = 0; i < n && done < length; i++) {
+        size_t part = length - done < iov[i].iov_len ? length - done : iov[i].iov_len;
+        memcpy(iov[i].iov_base, buf + done, part);
+        done += part;
+    }
+    spsc_produce(r, done);
+    return done;
+}
+
+static inline size_t spsc_read(spsc_ring_t* r, uint8_t* buf, size_t length) {
+    struct iovec iov[2];
+    int n = spsc_drain_iov(r, iov);
+    size_t done = 0;
+    for (int i = 0; i < n && done < length; i++) {
+        size_t part = length - done < iov[i].iov_len ? length - done : iov[i].iov_len;
+        memcpy(buf + done, iov[i].iov_base, part);
+        done += part;
+    }
+    spsc_consume(r, done);
+    return done;
+}
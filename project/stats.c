@@ -0,0 +1,63 @@
+#include <inttypes.h>
+
+#include "stats.h"
+
+// Largest value bucket i can hold
+static uint64_t bucket_bound(int i) {
+    if (i == HIST_BUCKETS - 1)
+        return UINT64_MAX;
+    return i == 0 ? 0 : (1ULL << i) - 1;
+}
+
+static uint64_t percentile(const histogram_t* h, double fraction) {
+    uint64_t rank = (uint64_t) (h->count * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank)
+            return i == HIST_BUCKETS - 1 ? h->max : bucket_bound(i);
+    }
+    return h->max;
+}
+
+void fprint_hist_json(FILE* out, const histogram_t* h) {
+    fprintf(out,
+            "{\"count\":%" PRIu64 ",\"mean\":%" PRIu64 ",\"max\":%" PRIu64
+            ",\"p50\":%" PRIu64 ",\"p90\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"buckets\":[",
+            h->count, h->count ? h->sum / h->count : 0, h->max, percentile(h, 0.5),
+            percentile(h, 0.9), percentile(h, 0.99));
+    const char* sep = "";
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (h->buckets[i] == 0)
+            continue;
+        uint64_t bound = i == HIST_BUCKETS - 1 ? h->max : bucket_bound(i);
+        fprintf(out, "%s[%" PRIu64 ",%" PRIu64 "]", sep, bound, h->buckets[i]);
+        sep = ",";
+    }
+    fprintf(out, "]}");
+}
+
+void fprint_stats_json(FILE* out, const stats_t* s) {
+    fprintf(out,
+            "\"bytes_sent\":%" PRIu64 ",\"bytes_acked\":%" PRIu64
+            ",\"bytes_delivered\":%" PRIu64 ",\"packets_sent\":%" PRIu64
+            ",\"packets_received\":%" PRIu64 ",\"corrupt\":%" PRIu64
+            ",\"retransmits\":%" PRIu64 ",\"fast_retransmits\":%" PRIu64
+            ",\"timeouts\":%" PRIu64 ",\"window_probes\":%" PRIu64 ",\"dup_acks\":%" PRIu64
+            ",\"acks_sent\":%" PRIu64 ",\"acks_piggybacked\":%" PRIu64
+            ",\"acks_saved\":%" PRIu64 ",\"lz_input\":%" PRIu64 ",\"lz_output\":%" PRIu64
+            ",\"fec_repairs\":%" PRIu64 ",\"fec_rebuilt\":%" PRIu64,
+            s->bytes_sent, s->bytes_acked, s->bytes_delivered, s->packets_sent,
+            s->packets_received, s->corrupt, s->retransmits, s->fast_retransmits,
+            s->timeouts, s->window_probes, s->dup_acks, s->acks_sent,
+            s->acks_piggybacked, s->acks_saved, s->lz_input, s->lz_output, s->fec_repairs,
+            s->fec_rebuilt);
+    fprintf(out, ",\"rtt_us\":");
+    fprint_hist_json(out, &s->rtt);
+    fprintf(out, ",\"ack_delay_us\":");
+    fprint_hist_json(out, &s->ack_delay);
+    fprintf(out, ",\"delivery_us\":");
+    fprint_hist_json(out, &s->delivery);
+    fprintf(out, ",\"window_bytes\":");
+    fprint_hist_json(out, &s->window);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Histogram with power-of-two buckets: bucket 0 counts zeros, bucket i > 0
+// counts values in [2^(i-1), 2^i). The last bucket takes everything larger.
+#define HIST_BUCKETS 40
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} histogram_t;
+
+// Counters of one connection. Only the worker that owns the connection
+// writes and dumps them, so they need no locking; serve_loop reads them
+// itself only after joining that worker.
+typedef struct {
+    uint64_t bytes_sent;       // Payload sent for the first time
+    uint64_t bytes_acked;      // Payload the peer acknowledged cumulatively
+    uint64_t bytes_delivered;  // Payload received in order and written out
+    uint64_t packets_sent;     // Data packets, first transmissions only
+    uint64_t packets_received; // Datagrams from the peer, control included
+    uint64_t corrupt;          // Received packets that failed verification, or LZ
+                               // blocks that failed to expand
+    uint64_t retransmits;      // Packets sent more than once
+    uint64_t fast_retransmits; // Recoveries started by duplicate ACKs
+    uint64_t timeouts;         // Retransmission timer firings with data out
+    uint64_t window_probes;    // Timer firings that probed a closed window
+    uint64_t dup_acks;         // Duplicate ACKs received
+    uint64_t acks_sent;        // Pure ACKs sent
+    uint64_t acks_piggybacked; // ACKs carried on data instead
+    uint64_t acks_saved;       // Data packets received that no pure ACK of
+                               // their own answered, as delayed ACKs cover
+                               // several and data carries them
+    uint64_t lz_input;         // Input compressed into LZ blocks
+    uint64_t lz_output;        // Payload of those blocks; lz_input over this is
+                               // the compression ratio
+    uint64_t fec_repairs;      // FEC repair packets sent
+    uint64_t fec_rebuilt;      // Lost packets rebuilt from repair packets
+
+    histogram_t rtt;       // Round-trip samples, usec
+    histogram_t ack_delay; // Data packet arrival to the ACK covering it, usec
+    histogram_t delivery;  // input_io to the peer acknowledging it, usec
+    histogram_t window;    // Send window after each ACK that released data
+} stats_t;
+
+static inline void hist_add(histogram_t* h, uint64_t value) {
+    int bucket = value ? 64 - __builtin_clzll(value) : 0;
+    h->buckets[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+// Write 'h' as a JSON object: count, mean, max, estimated p50/p90/p99 (the
+// upper bound of the bucket holding them) and the non-empty buckets as
+// [upper bound, count] pairs
+void fprint_hist_json(FILE* out, const histogram_t* h);
+
+// Write the counters and histograms as the members of a JSON object,
+// without the enclosing braces, so callers can add their own
+void fprint_stats_json(FILE* out, const stats_t* stats);
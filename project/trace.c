@@ -0,0 +1,32 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static int trace_fd = -1;
+
+bool trace_open(const char* path) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    return trace_fd >= 0;
+}
+
+trace_t* trace_new() {
+    if (trace_fd < 0)
+        return NULL;
+    return calloc(1, sizeof(trace_t));
+}
+
+// Workers share the file; O_APPEND keeps each ring's write in one piece
+void trace_flush(trace_t* trace) {
+    size_t bytes = trace->count * sizeof(trace_record_t);
+    const char* data = (const char*) trace->records;
+    while (bytes > 0) {
+        ssize_t n = write(trace_fd, data, bytes);
+        if (n <= 0)
+            break;
+        data += n;
+        bytes -= n;
+    }
+    trace->count = 0;
+}
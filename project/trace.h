@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "consts.h"
+
+// Binary packet trace. Each worker fills its own fixed-size ring of records
+// and writes it to the trace file in one write() when the ring is full or a
+// flush is asked for. The file is a plain array of trace_record_t in host
+// byte order; tracedump prints it in print_diag's text format.
+
+// Records per ring
+#define TRACE_RECORDS 4096
+
+typedef struct {
+    uint64_t time;  // Microseconds since the epoch
+    uint32_t seq;   // Header fields, in host byte order; seq and ack with
+    uint32_t ack;   // the packet_ext halves, length without the extension
+    uint16_t length;
+    uint16_t win;
+    uint16_t flags;
+    uint16_t port;  // Peer's port, to tell connections apart
+    uint8_t event;  // RECV, SEND, RTOS or DUPS
+} trace_record_t;
+
+typedef struct {
+    trace_record_t records[TRACE_RECORDS];
+    int count;
+} trace_t;
+
+// Start tracing to 'path'. Returns false if the file cannot be opened.
+bool trace_open(const char* path);
+
+// A ring for one worker, or NULL when tracing is off
+trace_t* trace_new();
+
+// Write out and empty the ring
+void trace_flush(trace_t* trace);
+
+// Record one packet; 'port' is the peer's, in network byte order
+static inline void trace_packet(trace_t* trace, const packet* pkt, int event,
+                                uint16_t port) {
+    trace_record_t* r = &trace->records[trace->count];
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    r->time = now.tv_sec * 1000000ULL + now.tv_usec;
+    r->seq = wire_seq(pkt);
+    r->ack = wire_ack(pkt);
+    r->length = data_length(pkt);
+    r->win = ntohs(pkt->win);
+    r->flags = pkt->flags;
+    r->port = ntohs(port);
+    r->event = event;
+    if (++trace->count == TRACE_RECORDS)
+        trace_flush(trace);
+}
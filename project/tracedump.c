@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+// Print a binary trace written with -t in the diagnostic text format, one
+// line per record. With -t each line is prefixed with the record's time,
+// relative to the first record, and the peer's port.
+int main(int argc, char** argv) {
+    bool times = argc == 3 && strcmp(argv[1], "-t") == 0;
+    if (argc != 2 && !times) {
+        fprintf(stderr, "Usage: tracedump [-t] <trace file>\n");
+        return 1;
+    }
+
+    FILE* in = fopen(argv[argc - 1], "rb");
+    if (!in) {
+        perror(argv[argc - 1]);
+        return 1;
+    }
+
+    trace_record_t r;
+    uint64_t start = 0;
+    bool first = true;
+    while (fread(&r, sizeof(r), 1, in) == 1) {
+        if (first) {
+            start = r.time;
+            first = false;
+        }
+        if (times)
+            printf("%10.6f %5hu ", (r.time - start) / 1e6, r.port);
+        fprint_diag_fields(stdout, r.event, r.seq, r.ack, r.length, r.win, r.flags);
+    }
+    fclose(in);
+    return 0;
+}
@@ -1,222 +1,1870 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/net_tstamp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
 
+#include "buffer.h"
+#include "cc.h"
 #include "consts.h"
+#include "integrity.h"
+#include "io.h"
+#include "fec.h"
+#include "lz.h"
+#include "pacer.h"
+#include "rtt.h"
+#include "stats.h"
+#include "trace.h"
+#include "transport.h"
+
+options_t options = {.output_dir = NULL, .workers = 1, .sack = true, .ext = true, .mss = MAX_PAYLOAD, .offload = true, .pacing = false, .lz = false, .io_threads = false, .fec = false};
+
+// Connection states
+#define SYN_RECEIVED 0 // Server sent its SYN-ACK; the peer's ACK is pending
+#define ESTABLISHED 1
+
+// Most data a SYN or SYN-ACK carries: a MAX_PACKET with its syn_options
+#define SYN_DATA (MAX_PAYLOAD - sizeof(syn_options))
 
-// buffer as linked list
-#define MAX_BUFFER_ENTRIES 70
+// Input read ahead to be compressed: data[start, end) is waiting to go out.
+// It holds two blocks, so what is left moves to the front at most once per
+// block's worth sent.
+#define LZ_STAGE (2 * LZ_BLOCK)
+
+// Packets sent raw, without trying, after one that did not compress: twice
+// as many after each further failure, up to the maximum
+#define LZ_BACKOFF 8
+#define LZ_BACKOFF_MAX 32
 
 typedef struct
 {
-    packet pkt;         // Full packet header + payload
-    size_t payload_len; // Actual number of payload bytes in this packet
-    bool acked;
-} buffer_entry_t;
+    lz_encoder_t encoder;
+    uint8_t data[LZ_STAGE];
+    size_t start, end;
+    int skip;    // Packets left to send before trying to compress again
+    int backoff; // What 'skip' is set to after the next failure
+} lz_stage_t;
+
+// Everything the transport keeps about one peer
+typedef struct conn
+{
+    struct sockaddr_in addr; // Peer address, the connection's key
+    int state;               // Curr state
+    int window;              // Total num bytes in sending window
+    int dup_acks;            // Counting duplicate ACKs
+    uint32_t ack;            // ACK
+    uint32_t seq;            // Seq
+    uint32_t last_ack;       // Last ack, keeps track of dupe ACKs
+    uint32_t isn;            // Our initial seq, to resend the SYN-ACK with
+    uint32_t recover;        // Seq sent when loss was detected
+    bool recovering;         // ACKs below 'recover' are partial
+    uint32_t rexmit_next;    // Holes before this were resent this recovery
+    bool sack;               // Both ends negotiated SACK
+    bool lz;                 // Both ends negotiated LZ compression
+    lz_stage_t *stage;       // Input waiting to be compressed, once sending
+    bool fec;                // Both ends negotiated FEC:
+    fec_encoder_t *fec_tx;   // repair packets for what we send,
+    fec_decoder_t *fec_rx;   // and losses rebuilt from the peer's
+    bool ext;                // Both ends negotiated EXT: 32-bit seq and ack,
+    int wscale;              // and 'win' shifted by these, ours and
+    int peer_wscale;         // the peer's
+    int mss;                 // Largest payload of a packet either way
+    int peer_window;         // Bytes the peer last advertised
+    int adv_window;          // Bytes we last advertised
+    uint32_t tune_seq;       // Receive autotuning: ACK at the start of
+    long tune_start;         // the current round trip, and when it began
+    long syn_ack_sent;       // Server: times the handshake, 0 once resent
+    long ack_pending;        // Arrival of the oldest data not yet ACKed, or 0
+    long heard;              // Arrival of the peer's last packet
+    int unacked;             // Data packets received since the last ACK
+    int quick_acks;          // Packets still to ACK without delay
+    uint32_t held_end;       // One past the highest seq received out of order
+    stats_t stats;           // Counters and histograms, dumped on SIGUSR1
+
+    sending_buffer_t send_buf;   // Unacknowledged packets, oldest first
+    receiving_buffer_t recv_buf; // Received packets not yet written out
+    int timer_fd;                // Retransmission timer
+    rtt_t rtt;                   // Drives the retransmission timeout
+    cc_state_t cc;               // Congestion control; sets 'window'
+    pacer_t pacer;               // Spaces out new data, with -P
+
+    bool stdio;        // Reads stdin and writes stdout through the IO layer
+    int out_fd;        // Otherwise, the file received data is written to
+    struct conn *next; // Next connection in the same hash bucket
+    struct conn *link; // Next connection of the worker, in any bucket
+} conn_t;
+
+ssize_t (*input)(uint8_t *, size_t); // Get data from layer
+size_t (*output)(uint8_t *, size_t);   // Output data from layer
+
+// Datagrams moved per sendmmsg/recvmmsg call
+#define BATCH_SIZE 64
+
+// UDP segmentation offload: most datagrams the kernel splits one message
+// into, and most bytes in that message. A receive slot holds GRO_BUFFER bytes
+// of datagrams the kernel coalesced.
+#define GSO_SEGMENTS 64
+#define GSO_BYTES 65507
+#define GRO_BUFFER 65536
+
+// Room for the control messages of one datagram (a GSO segment size and an
+// SO_TXTIME departure time) or of a received one (a GRO segment size)
+typedef union
+{
+    char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint64_t))];
+    struct cmsghdr align;
+} control_t;
+
+// Hash buckets in a worker's connection table
+#define CONN_BUCKETS 256
 
+// Most connections a serve_loop worker holds, each with a timer and an output
+// file open, and descriptors kept back for everything else
+#define MAX_CONNS 1024
+#define RESERVED_FDS 64
+
+// One event loop: a socket and the connections that arrive on it
 typedef struct
 {
-    buffer_entry_t entries[MAX_BUFFER_ENTRIES];
-    int head;          // Index of the oldest (first unacknowledged) packet
-    int tail;          // Next free slot for a new packet
-    int count;         // # of packets currently in the buffer
-    int total_payload; // Total payload bytes currently unacknowledged
-} sending_buffer_t;
+    int sockfd;
+    conn_t *table[CONN_BUCKETS]; // Connections, hashed by peer address/port
+    conn_t *conns;               // The same connections, as one list
+    int conn_count;
+    int max_conns; // SYNs from new peers beyond this are ignored
+    int id;        // Position in serve_loop's pool, for print_stats
+    atomic_bool dump; // serve_loop asks for print_stats through wake_fd
+    unsigned seed; // Initial sequence numbers
+
+    struct mmsghdr send_msgs[BATCH_SIZE]; // Queued for the next sendmmsg
+    struct iovec send_iov[BATCH_SIZE];
+    char ack_buffers[BATCH_SIZE][MAX_PACKET]; // Control packets, by queue slot
+    uint64_t send_time[BATCH_SIZE];      // SO_TXTIME departure, ns, or 0
+    control_t send_control[BATCH_SIZE];  // That departure time
+    int send_count;
+    bool txtime; // The kernel takes departure times (SO_TXTIME)
+    bool gso;    // Runs of queued packets go out as one message (UDP_SEGMENT)
+    struct mmsghdr gso_msgs[BATCH_SIZE]; // Those runs, built by packet_flush
+    int gso_first[BATCH_SIZE];           // Queue slot of each run's first packet
+    control_t gso_control[BATCH_SIZE];   // Each run's segment size and departure
+
+    struct mmsghdr recv_msgs[BATCH_SIZE];
+    struct iovec recv_iov[BATCH_SIZE];
+    struct sockaddr_in recv_addrs[BATCH_SIZE];
+    control_t recv_control[BATCH_SIZE]; // Segment size of coalesced datagrams
+    bool gro;           // The kernel may coalesce datagrams (UDP_GRO)
+    char *recv_buffers; // BATCH_SIZE slots of recv_size bytes
+    size_t recv_size;   // packet_size, or GRO_BUFFER with GRO
+    size_t packet_size; // Largest datagram for options.mss
+    char *scratch;      // One packet_size packet, to realign datagrams in
+
+    // Packets handled and syscalls spent on each direction
+    uint64_t tx_packets, tx_calls;
+    uint64_t rx_packets, rx_calls;
+
+    long rx_time; // When the last recvmmsg returned
 
-// Initialize the buffer
-void init_sending_buffer(sending_buffer_t *buf)
+    int ack_fd;     // Delayed ACK timer, armed while any ACK is held back
+    bool ack_armed;
+    int pace_fd;    // Wakes the connection the pacer holds back, with -P
+    conn_t *paced;  // That connection, or NULL
+    trace_t *trace; // Packet trace ring, NULL unless -t was given
+    int wake_fd;    // serve_loop's requests to flush the ring or stop, or -1
+} worker_t;
+
+volatile sig_atomic_t dump_requested = 0;
+atomic_bool stop_requested = false; // Workers return from worker_loop
+
+// Packet Construction. Packets are sealed (parity, CRC) here, except when the
+// payload is already in place: add_packet seals those in the sending buffer.
+// With EXT in 'flags', the packet_ext goes in front of the 'len' bytes of
+// payload and the upper halves of 'seq' and 'ack' go in it.
+static void packet_create(packet *pkt, uint32_t seq, uint32_t ack, uint16_t len, uint16_t win, uint16_t flags, uint8_t *payload)
 {
-    buf->head = 0;
-    buf->tail = 0;
-    buf->count = 0;
-    buf->total_payload = 0;
+    pkt->seq = htons((uint16_t)seq);
+    pkt->ack = htons((uint16_t)ack);
+    pkt->length = htons(len + (flags & EXT ? sizeof(packet_ext) : 0));
+    pkt->win = htons(win);
+    pkt->flags = flags;
+    pkt->unused = 0;
+    if (flags & EXT)
+    {
+        packet_ext *ext = (packet_ext *)pkt->payload;
+        ext->seq_hi = htons(seq >> 16);
+        ext->ack_hi = htons(ack >> 16);
+    }
+    if (payload && len > 0)
+    {
+        seal_copy(pkt, payload, len);
+    }
+    else if (len == 0)
+    {
+        seal_packet(pkt);
+    }
 }
 
-// Check if adding a new packet with payload size 'payload_size' would exceed the window
-bool can_send_packet(sending_buffer_t *buf, size_t payload_size)
+// Packet Sender
+static ssize_t packet_send(int sockfd, struct sockaddr_in *addr, packet *pkt)
 {
-    return (buf->total_payload + payload_size) <= MAX_WINDOW;
+    return sendto(sockfd, pkt, sizeof(packet) + ntohs(pkt->length), 0, (struct sockaddr *)addr, sizeof(*addr));
 }
 
-// Add a new packet to the sending buffer.
-// Returns true on success, false if there's no room (either by payload or by number of entries).
-bool add_packet(sending_buffer_t *buf, packet *pkt, size_t payload_size)
-{ // <-- payload_size is not necessary since it's always pkt->len + 12 bytes
-    if (!can_send_packet(buf, payload_size))
+// Packer Receiver; skips datagrams that are truncated or fail verification
+static ssize_t packet_receive(int sockfd, struct sockaddr_in *addr, packet *pkt)
+{
+    while (true)
     {
-        return false;
+        socklen_t addr_len = sizeof(*addr);
+        ssize_t bytes = recvfrom(sockfd, pkt, MAX_PACKET, 0, (struct sockaddr *)addr, &addr_len);
+        if (bytes < 0)
+            return bytes;
+        if (bytes >= (ssize_t)sizeof(packet) &&
+            bytes == (ssize_t)(sizeof(packet) + ntohs(pkt->length)) &&
+            verify_packet(pkt))
+            return bytes;
+    }
+}
+
+// Send 'count' messages in as few sendmmsg calls as the kernel allows.
+// Returns how many went out; errno tells why the rest did not.
+static int send_messages(worker_t *w, struct mmsghdr *msgs, int count)
+{
+    int sent = 0;
+    while (sent < count)
+    {
+        int n = sendmmsg(w->sockfd, msgs + sent, count - sent, 0);
+        if (n <= 0)
+            break; // Lost datagrams are recovered like any other loss
+        w->tx_calls++;
+        for (int i = sent; i < sent + n; i++)
+            w->tx_packets += msgs[i].msg_hdr.msg_iovlen;
+        sent += n;
+    }
+    return sent;
+}
+
+// Append a control message to 'msg', whose msg_control has room for it
+static void add_control(struct msghdr *msg, int level, int type, const void *data, size_t len)
+{
+    struct cmsghdr *cmsg = (struct cmsghdr *)((char *)msg->msg_control + msg->msg_controllen);
+    cmsg->cmsg_level = level;
+    cmsg->cmsg_type = type;
+    cmsg->cmsg_len = CMSG_LEN(len);
+    memcpy(CMSG_DATA(cmsg), data, len);
+    msg->msg_controllen += CMSG_SPACE(len);
+}
+
+// Group the queue into GSO messages: runs of packets to the same peer, all
+// as long as the first but for a shorter last one. Each run's iovecs point at
+// its packets where they are queued, so nothing is copied. Returns the number
+// of messages. Paced packets only share a run with those due within a
+// PACE_QUANTUM of the first, whose departure time the run takes.
+static int gso_group(worker_t *w)
+{
+    int count = 0;
+    for (int i = 0, j; i < w->send_count; i = j)
+    {
+        struct msghdr *first = &w->send_msgs[i].msg_hdr;
+        size_t size = w->send_iov[i].iov_len;
+        size_t total = size;
+        uint64_t time = w->send_time[i];
+        for (j = i + 1; j < w->send_count && j - i < GSO_SEGMENTS; j++)
+        {
+            size_t next = w->send_iov[j].iov_len;
+            if (w->send_msgs[j].msg_hdr.msg_name != first->msg_name ||
+                w->send_iov[j - 1].iov_len != size || next > size || total + next > GSO_BYTES)
+                break;
+            if ((w->send_time[j] > 0) != (time > 0) || w->send_time[j] > time + PACE_QUANTUM * 1000)
+                break;
+            total += next;
+        }
+
+        struct msghdr *msg = &w->gso_msgs[count].msg_hdr;
+        *msg = *first;
+        msg->msg_iovlen = j - i;
+        msg->msg_control = w->gso_control[count].buf;
+        msg->msg_controllen = 0;
+        if (time > 0)
+            add_control(msg, SOL_SOCKET, SCM_TXTIME, &time, sizeof(time));
+        if (j - i > 1)
+        {
+            uint16_t segment = size;
+            add_control(msg, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment));
+        }
+        if (msg->msg_controllen == 0)
+            msg->msg_control = NULL;
+        w->gso_first[count++] = i;
+    }
+    return count;
+}
+
+// Send every queued packet, runs of them per message with GSO
+static void packet_flush(worker_t *w)
+{
+    int first = 0; // Queue slot of the first packet to send one per message
+    if (w->gso)
+    {
+        int count = gso_group(w);
+        int sent = send_messages(w, w->gso_msgs, count);
+        first = w->send_count;
+        // Kernels and devices without segmentation offload refuse the
+        // message; send the rest, and everything from now on, one by one
+        if (sent < count && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP))
+        {
+            w->gso = false;
+            first = w->gso_first[sent];
+        }
+    }
+    send_messages(w, w->send_msgs + first, w->send_count - first);
+    w->send_count = 0;
+}
+
+// Queue a packet for the next flush, to leave at 'time' (CLOCK_MONOTONIC ns)
+// with SO_TXTIME or at once if 0. The packet must stay put until the flush.
+static void packet_queue_at(worker_t *w, struct sockaddr_in *addr, packet *pkt, uint64_t time)
+{
+    if (w->send_count == BATCH_SIZE)
+        packet_flush(w);
+
+    int i = w->send_count++;
+    w->send_iov[i].iov_base = pkt;
+    w->send_iov[i].iov_len = sizeof(packet) + ntohs(pkt->length);
+    w->send_msgs[i].msg_hdr = (struct msghdr){
+        .msg_name = addr,
+        .msg_namelen = sizeof(*addr),
+        .msg_iov = &w->send_iov[i],
+        .msg_iovlen = 1,
+    };
+    w->send_time[i] = w->txtime ? time : 0;
+    if (w->send_time[i] > 0)
+    {
+        w->send_msgs[i].msg_hdr.msg_control = w->send_control[i].buf;
+        add_control(&w->send_msgs[i].msg_hdr, SOL_SOCKET, SCM_TXTIME, &w->send_time[i], sizeof(uint64_t));
+    }
+    if (w->trace)
+        trace_packet(w->trace, pkt, SEND, addr->sin_port);
+}
+
+// Queue a packet to leave as soon as it is flushed
+static void packet_queue(worker_t *w, struct sockaddr_in *addr, packet *pkt)
+{
+    packet_queue_at(w, addr, pkt, 0);
+}
+
+// The options of a SYN or SYN-ACK, or NULL if it did not offer EXT
+static const syn_options *syn_options_of(packet *pkt)
+{
+    if (!(pkt->flags & EXT) || data_length(pkt) < sizeof(syn_options))
+        return NULL;
+    return (const syn_options *)packet_data(pkt);
+}
+
+// The data a SYN or SYN-ACK carries after any syn_options, '*len' bytes
+static uint8_t *syn_data(packet *pkt, size_t *len)
+{
+    size_t skip = syn_options_of(pkt) ? sizeof(syn_options) : 0;
+    *len = data_length(pkt) - skip;
+    return packet_data(pkt) + skip;
+}
+
+static long now_us();
+
+// Client side of the handshake, up to the SYN-ACK, which 'syn_ack' (MAX_PACKET
+// bytes) receives; the connection it sets up sends the final ACK. The SYN
+// carries 'len' bytes of 'data' (at most SYN_DATA), the first packet's worth.
+// Returns the round trip of the SYN, 0 if it had to be resent or took as long
+// as the server waits to resend its SYN-ACK (either way, which copy was
+// answered is unknown), or -1.
+static long handshake(int sockfd, struct sockaddr_in *addr, uint32_t client_seq, const uint8_t *data,
+                      size_t len, packet *syn_ack)
+{
+    char buffer[MAX_PACKET];
+    packet *pkt = (packet *)&buffer;
+    uint8_t payload[MAX_PAYLOAD];
+    syn_options offer = {.wscale = WINDOW_SCALE, .mss = htons(options.mss)};
+    uint16_t flags = SYN | (options.sack ? SACK : 0) | (options.ext ? EXT : 0) | (options.lz ? LZ : 0) |
+                     (options.fec ? FEC : 0);
+    size_t offset = options.ext ? sizeof(offer) : 0;
+    memcpy(payload, &offer, offset);
+    memcpy(payload + offset, data, len);
+    packet_create(pkt, client_seq, 0, offset + len, RECV_WINDOW_INIT, flags, payload);
+
+    // Send the SYN, again after a timeout that doubles from SYN_RTO up to
+    // RTO_INIT until the SYN-ACK arrives; a busy server drops SYNs like
+    // anything else, and one that is not up yet gets asked once a second
+    long rto = SYN_RTO;
+    long sent = 0;
+    bool resent = false;
+    ssize_t received;
+    do
+    {
+        struct timeval timeout = {rto / 1000000, rto % 1000000};
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        resent = sent > 0;
+        sent = now_us();
+        packet_send(sockfd, addr, pkt);
+        rto = MIN(2 * rto, RTO_INIT);
+    } while ((received = packet_receive(sockfd, addr, syn_ack)) < 0 && errno == EAGAIN);
+    struct timeval forever = {0};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &forever, sizeof(forever));
+
+    // Receive SYN-ACK
+    if (received < 0 || !(syn_ack->flags & SYN) || !(syn_ack->flags & ACK))
+        return -1;
+    long rtt = now_us() - sent;
+    return resent || rtt >= SYN_RTO ? 0 : MAX(rtt, 1);
+}
+
+static long now_us()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000L + now.tv_usec;
+}
+
+// The clock SO_TXTIME departure times are read on
+static uint64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static unsigned conn_bucket(const struct sockaddr_in *addr)
+{
+    uint32_t h = addr->sin_addr.s_addr * 2654435761u ^ addr->sin_port;
+    return (h ^ (h >> 16)) % CONN_BUCKETS;
+}
+
+static conn_t *find_conn(worker_t *w, const struct sockaddr_in *addr)
+{
+    for (conn_t *c = w->table[conn_bucket(addr)]; c; c = c->next)
+    {
+        if (c->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            c->addr.sin_port == addr->sin_port)
+            return c;
+    }
+    return NULL;
+}
+
+// Apply the congestion window and the peer's window to the sending buffer
+static void update_window(conn_t *c)
+{
+    c->window = MIN(MIN(c->cc.cwnd, MAX_WINDOW), c->peer_window);
+    c->send_buf.window = c->window;
+}
+
+// Largest receive window this connection can advertise
+static int recv_window_max(conn_t *c)
+{
+    return c->ext ? EXT_WINDOW_MAX : RECV_WINDOW_MAX;
+}
+
+// Window to advertise, in the units of 'win', remembered in bytes to tell
+// when an update is worth sending
+static uint16_t advertise(conn_t *c)
+{
+    int window = MIN(receive_window(&c->recv_buf), recv_window_max(c));
+    c->adv_window = window >> c->wscale << c->wscale;
+    return window >> c->wscale;
+}
+
+// Add a connection whose handshake settled on 'seq' and 'ack'. What it
+// negotiates comes from the peer's SYN or SYN-ACK, 'syn', against our options.
+// Returns NULL if there is no descriptor left for its timer.
+static conn_t *add_conn(worker_t *w, const struct sockaddr_in *addr, uint32_t seq, uint32_t ack, packet *syn)
+{
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timer_fd < 0)
+    {
+        perror("timerfd_create");
+        return NULL;
+    }
+    conn_t *c = calloc(1, sizeof(conn_t));
+    c->timer_fd = timer_fd;
+    c->heard = now_us();
+    c->addr = *addr;
+    c->seq = seq;
+    c->ack = ack;
+    c->last_ack = seq;
+    c->held_end = ack;
+    c->quick_acks = QUICK_ACKS;
+    c->out_fd = -1;
+
+    c->sack = options.sack && (syn->flags & SACK);
+    c->lz = options.lz && (syn->flags & LZ);
+    c->fec = options.fec && (syn->flags & FEC);
+    c->mss = MAX_PAYLOAD;
+    const syn_options *offer = syn_options_of(syn);
+    if (options.ext && offer)
+    {
+        c->ext = true;
+        c->wscale = WINDOW_SCALE;
+        c->peer_wscale = MIN(offer->wscale, 14);
+        // Never below the default, which SYN data and every slot assume
+        int offered = MAX(ntohs(offer->mss), MAX_PAYLOAD);
+        c->mss = MIN(options.mss, offered);
+    }
+
+    int window = MIN(RECV_WINDOW_PACKETS * c->mss, recv_window_max(c));
+    init_sending_buffer(&c->send_buf, seq, window, c->mss);
+    init_receiving_buffer(&c->recv_buf, ack, window, c->mss);
+    if (c->fec)
+    {
+        c->fec_tx = malloc(sizeof(fec_encoder_t));
+        c->fec_rx = malloc(sizeof(fec_decoder_t));
+        fec_encoder_init(c->fec_tx, c->mss, c->ext);
+        fec_decoder_init(c->fec_rx, c->mss, ack);
+    }
+    init_rtt(&c->rtt);
+    pacer_init(&c->pacer);
+    cc_ops()->init(&c->cc, c->mss);
+    c->peer_window = ntohs(syn->win); // Never scaled in a SYN
+    c->adv_window = window;
+    update_window(c);
+
+    unsigned bucket = conn_bucket(addr);
+    c->next = w->table[bucket];
+    w->table[bucket] = c;
+    c->link = w->conns;
+    w->conns = c;
+    w->conn_count++;
+    return c;
+}
+
+// Remove a connection and release everything it holds
+static void close_conn(worker_t *w, conn_t *c)
+{
+    conn_t **p = &w->table[conn_bucket(&c->addr)];
+    while (*p != c)
+        p = &(*p)->next;
+    *p = c->next;
+    for (p = &w->conns; *p != c; p = &(*p)->link)
+        ;
+    *p = c->link;
+    w->conn_count--;
+    if (w->paced == c)
+        w->paced = NULL;
+
+    close(c->timer_fd);
+    if (c->out_fd >= 0)
+        close(c->out_fd);
+    free_sending_buffer(&c->send_buf);
+    free_receiving_buffer(&c->recv_buf);
+    free(c->stage);
+    if (c->fec)
+    {
+        fec_encoder_free(c->fec_tx);
+        fec_decoder_free(c->fec_rx);
+        free(c->fec_tx);
+        free(c->fec_rx);
+    }
+    free(c);
+}
+
+// Everything received so far was just acknowledged, by a pure ACK or on data
+static void acked(conn_t *c, bool pure)
+{
+    if (c->ack_pending > 0)
+    {
+        hist_add(&c->stats.ack_delay, MAX(now_us() - c->ack_pending, 0));
+        c->ack_pending = 0;
+    }
+    if (c->unacked > 0)
+        c->stats.acks_saved += c->unacked - (pure ? 1 : 0);
+    c->unacked = 0;
+}
+
+// Queue a control packet, built in the ACK storage of its queue slot. Pure
+// ACKs on a SACK connection carry the bitmap of packets held out of order,
+// and a SYN-ACK on an EXT connection its syn_options, then any SYN data.
+static void queue_control(worker_t *w, conn_t *c, uint32_t seq, uint16_t flags)
+{
+    if (w->send_count == BATCH_SIZE)
+        packet_flush(w);
+    packet *reply = (packet *)&w->ack_buffers[w->send_count];
+    uint8_t payload[MAX_PAYLOAD];
+    size_t len = 0;
+    uint16_t win = advertise(c);
+    if (flags == ACK)
+        c->stats.acks_sent++;
+    // With FEC, a pure ACK reports the loss rate ahead of any SACK bitmap
+    size_t head = c->fec && flags == ACK ? 1 : 0;
+    if (head > 0)
+        payload[0] = fec_loss(c->fec_rx);
+    if (c->sack && flags == ACK)
+        len = sack_bitmap(&c->recv_buf, payload + head, SACK_BYTES);
+    if (len > 0)
+        flags |= SACK;
+    if (head > 0)
+    {
+        flags |= FEC;
+        len += head;
+    }
+    if (flags & SYN)
+    {
+        // The window in a SYN-ACK is never scaled
+        win = MIN(c->adv_window, RECV_WINDOW_MAX);
+        if (c->ext)
+        {
+            syn_options answer = {.wscale = c->wscale, .mss = htons(c->mss)};
+            memcpy(payload, &answer, sizeof(answer));
+            len = sizeof(answer);
+        }
+
+        // Until the handshake completes, the first packet of data rides on
+        // every SYN-ACK
+        buffer_entry_t *first = c->state == SYN_RECEIVED ? find_packet(&c->send_buf, c->isn + 1) : NULL;
+        if (first)
+        {
+            memcpy(payload + len, packet_data(first->pkt), data_length(first->pkt));
+            len += data_length(first->pkt);
+        }
+    }
+    packet_create(reply, seq, c->ack, len, win, flags | (c->ext ? EXT : 0), payload);
+    packet_queue(w, &c->addr, reply);
+    acked(c, true);
+}
+
+// Queue the server's SYN-ACK, first or again. Once resent, neither it nor
+// the data it carries can time the round trip.
+static void queue_syn_ack(worker_t *w, conn_t *c, bool resend)
+{
+    buffer_entry_t *first = find_packet(&c->send_buf, c->isn + 1);
+    if (resend)
+    {
+        c->syn_ack_sent = 0;
+        if (first)
+        {
+            first->retransmitted = true;
+            gettimeofday(&first->resent, NULL);
+        }
+    }
+    queue_control(w, c, c->isn, SYN | ACK | (c->sack ? SACK : 0) | (c->lz ? LZ : 0) | (c->fec ? FEC : 0));
+}
+
+// Where the payload of the next data packet goes, in the sending buffer, so
+// that input is read straight into the packet that is sent and kept
+static uint8_t *next_payload(conn_t *c)
+{
+    return next_packet(&c->send_buf)->payload + (c->ext ? sizeof(packet_ext) : 0);
+}
+
+// Put the header on the 'len' bytes at next_payload and add the packet to the
+// sending buffer
+static buffer_entry_t *add_data(conn_t *c, size_t len, uint16_t flags)
+{
+    packet_create(next_packet(&c->send_buf), c->seq, c->ack, (uint16_t)len, advertise(c), flags, NULL);
+    buffer_entry_t *entry = add_packet(&c->send_buf, len);
+    c->seq++;
+    c->stats.bytes_sent += len;
+    c->stats.packets_sent++;
+    return entry;
+}
+
+// Put 'len' bytes of 'data' in the sending buffer as the next packet, which
+// the SYN carried first
+static buffer_entry_t *add_syn_data(conn_t *c, const uint8_t *data, size_t len)
+{
+    memcpy(next_payload(c), data, len);
+    return add_data(c, len, ACK | (c->ext ? EXT : 0));
+}
+
+// Queue one packet again, carrying the current ACK and window rather than
+// those it was first sent with, which would take the peer's view of both back
+static void retransmit(worker_t *w, conn_t *c, buffer_entry_t *entry)
+{
+    packet *pkt = entry->pkt;
+    pkt->ack = htons((uint16_t)c->ack);
+    pkt->win = htons(advertise(c));
+    if (pkt->flags & EXT)
+        ((packet_ext *)pkt->payload)->ack_hi = htons(c->ack >> 16);
+    seal_packet(pkt);
+    if (c->unacked > 0)
+    {
+        c->stats.acks_piggybacked++;
+        acked(c, false);
+    }
+
+    entry->retransmitted = true;
+    gettimeofday(&entry->resent, NULL);
+    c->stats.retransmits++;
+    packet_queue(w, &c->addr, entry->pkt);
+}
+
+// Resend what the peer is missing. With SACK that is every packet up to the
+// highest SACKed one that was neither SACKed nor resent yet in this recovery,
+// or the oldest packet when nothing is SACKed; without SACK, the oldest packet.
+static void retransmit_holes(worker_t *w, conn_t *c)
+{
+    sending_buffer_t *buf = &c->send_buf;
+    if (!c->sack)
+    {
+        retransmit(w, c, find_packet(buf, buf->base));
+        packet_flush(w);
+        return;
+    }
+
+    if (seq_lt(c->rexmit_next, buf->base))
+        c->rexmit_next = buf->base;
+    uint32_t end = seq_lt(buf->base, buf->sack_high) ? buf->sack_high : buf->base + 1;
+    for (; seq_lt(c->rexmit_next, end); c->rexmit_next++)
+    {
+        buffer_entry_t *entry = find_packet(buf, c->rexmit_next);
+        if (entry && !entry->acked)
+            retransmit(w, c, entry);
+    }
+    packet_flush(w);
+}
+
+// Loss detected: everything sent so far has to be covered before recovery ends
+static void start_recovery(worker_t *w, conn_t *c)
+{
+    c->recover = c->send_buf.next;
+    c->recovering = true;
+    c->rexmit_next = c->send_buf.base;
+    retransmit_holes(w, c);
+}
+
+// Arm the retransmission timer, or disarm it when nothing is outstanding.
+// A connection writing to a file has no end of its own, so its timer then
+// runs until CONN_IDLE after the peer's last packet instead, to close it once
+// the peer has gone.
+static void set_timer(conn_t *c, bool armed)
+{
+    struct itimerspec spec = {0};
+    long idle = CONN_IDLE - (now_us() - c->heard);
+    long timeout = armed ? c->rtt.rto : c->stdio ? 0 : MAX(idle, 1);
+    spec.it_value.tv_sec = timeout / 1000000;
+    spec.it_value.tv_nsec = (timeout % 1000000) * 1000;
+    timerfd_settime(c->timer_fd, 0, &spec, NULL);
+}
+
+static void on_input(worker_t *w, conn_t *c);
+
+// Input read from stdin but not yet packetized
+static size_t staged(conn_t *c)
+{
+    return c->stage ? c->stage->end - c->stage->start : 0;
+}
+
+// True while the connection has stdin data to send, now or once it arrives
+static bool has_input(conn_t *c)
+{
+    return c->stdio && input && (!input_eof() || staged(c) > 0);
+}
+
+// True when there is data to send but the peer's window has no room for it
+// and nothing is in flight, so no ACK will come to say it opened. The
+// retransmission timer then probes the window instead.
+static bool window_closed(conn_t *c)
+{
+    return c->send_buf.count == 0 && c->peer_window < c->mss && has_input(c);
+}
+
+// True when the connection could send new data right now
+static bool can_send_data(worker_t *w, conn_t *c)
+{
+    return c->state == ESTABLISHED && has_input(c) && c != w->paced &&
+           can_send_packet(&c->send_buf, c->mss);
+}
+
+// Send the ACK held back once ACK_EVERY packets of in-order data wait for
+// it, or any while quick ACKs are on, or with 'all' whatever is held back.
+// Data going the other way carries it where it can. A pure ACK goes only
+// when no data is pending: with data in flight, the peer's next ACK opens
+// the window for data that carries ours, and the delayed ACK timer sends it
+// if not.
+static void ack_due(worker_t *w, conn_t *c, bool all)
+{
+    if (c->unacked == 0 || (!all && c->unacked < (c->quick_acks > 0 ? 1 : ACK_EVERY)))
+        return;
+    if (can_send_data(w, c))
+        on_input(w, c);
+    else if (!all && c->state == ESTABLISHED && has_input(c) && c->send_buf.count > 0)
+        return;
+    if (c->unacked > 0)
+        queue_control(w, c, 0, ACK);
+}
+
+// ack_due for every connection of the worker
+static void flush_acks(worker_t *w, bool all)
+{
+    for (conn_t *c = w->conns; c; c = c->link)
+        ack_due(w, c, all);
+}
+
+// Retransmission timer fired: resend the SYN-ACK, or else the oldest
+// unacknowledged packet
+static void on_timeout(worker_t *w, conn_t *c)
+{
+    uint64_t expirations;
+    if (read(c->timer_fd, &expirations, sizeof(expirations)) <= 0)
+        return;
+
+    if (!c->stdio && now_us() - c->heard >= CONN_IDLE)
+    {
+        close_conn(w, c);
+        return;
+    }
+
+    if (c->state == SYN_RECEIVED)
+    {
+        // The SYN-ACK or the ACK to it was lost; resending it also resends
+        // any data it carries
+        c->stats.timeouts++;
+        queue_syn_ack(w, c, true);
+        packet_flush(w);
+        rtt_backoff(&c->rtt);
+        set_timer(c, true);
+        return;
+    }
+
+    if (c->send_buf.count > 0)
+    {
+        if (w->trace)
+            trace_packet(w->trace, find_packet(&c->send_buf, c->send_buf.base)->pkt, RTOS, c->addr.sin_port);
+        c->stats.timeouts++;
+        start_recovery(w, c);
+        rtt_backoff(&c->rtt);
+        cc_ops()->on_timeout(&c->cc, now_us());
+        c->dup_acks = 0;
+        update_window(c);
+    }
+    else if (window_closed(c))
+    {
+        // Probe with one packet past the window; its ACK carries the window,
+        // and the retransmission timer backs off further probes
+        c->stats.window_probes++;
+        c->send_buf.window = c->mss;
+        on_input(w, c);
+        update_window(c);
+    }
+    set_timer(c, c->send_buf.count > 0 || window_closed(c));
+}
+
+// Received data of a stdio connection goes through the IO layer
+static void output_stdio(void *ctx, uint8_t *buf, size_t length)
+{
+    conn_t *c = ctx;
+    c->stats.bytes_delivered += output(buf, length);
+}
+
+// Received data of any other connection is written straight to its file
+static void output_file(void *ctx, uint8_t *buf, size_t length)
+{
+    conn_t *c = ctx;
+    c->stats.bytes_delivered += length;
+    while (length > 0)
+    {
+        ssize_t n = write(c->out_fd, buf, length);
+        if (n <= 0)
+            return;
+        buf += n;
+        length -= n;
+    }
+}
+
+// Hand over all in-order data the connection's output can take right now.
+// If that opens the window by half, tell the sender without waiting for data.
+static void deliver(worker_t *w, conn_t *c)
+{
+    if (c->stdio)
+        deliver_packets(&c->recv_buf, output_stdio, c, output_room());
+    else
+        deliver_packets(&c->recv_buf, output_file, c, SIZE_MAX);
+    c->stats.corrupt += c->recv_buf.lz_failed;
+    c->recv_buf.lz_failed = 0;
+
+    if (c->state == ESTABLISHED &&
+        receive_window(&c->recv_buf) - c->adv_window >= c->recv_buf.window / 2)
+        queue_control(w, c, 0, ACK);
+}
+
+// Receive autotuning: once per round trip, grow the window to twice what
+// arrived during it, so a sender held back by the window can keep doubling
+static void autotune(conn_t *c)
+{
+    if (!c->rtt.sampled)
+        return;
+    long now = now_us();
+    if (now - c->tune_start < c->rtt.srtt)
+        return;
+
+    int arrived = MIN(c->recv_buf.next - c->tune_seq, (uint32_t)(INT_MAX / c->mss)) * c->mss;
+    if (c->tune_start > 0 && 2 * arrived > c->recv_buf.window)
+        grow_receiving_buffer(&c->recv_buf, MIN(2 * arrived, recv_window_max(c)));
+    c->tune_seq = c->recv_buf.next;
+    c->tune_start = now;
+}
+
+// A SYN from a new peer: set up its connection, take the data the SYN
+// carries and answer with a SYN-ACK, resent on the retransmission timer until
+// the peer's ACK arrives. A SYN whose data would have nowhere to go is
+// ignored, and the peer's handshake fails, rather than acknowledging data
+// only to drop it.
+static void on_syn(worker_t *w, const struct sockaddr_in *addr, packet *pkt)
+{
+    if (w->conn_count >= w->max_conns || !verify_packet(pkt))
+        return;
+
+    int out_fd = -1;
+    if (options.output_dir)
+    {
+        char host[INET_ADDRSTRLEN];
+        char path[PATH_MAX];
+        inet_ntop(AF_INET, &addr->sin_addr, host, sizeof(host));
+        snprintf(path, sizeof(path), "%s/%s-%hu", options.output_dir, host, ntohs(addr->sin_port));
+        out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0)
+        {
+            perror(path);
+            return;
+        }
+    }
+
+    uint32_t isn = rand_r(&w->seed) % 1000;
+    conn_t *c = add_conn(w, addr, isn + 1, wire_seq(pkt) + 1, pkt);
+    if (!c)
+    {
+        if (out_fd >= 0)
+            close(out_fd);
+        return;
     }
-    if (buf->count >= MAX_BUFFER_ENTRIES)
+    c->out_fd = out_fd;
+    c->stdio = out_fd < 0;
+    c->isn = isn;
+    c->state = SYN_RECEIVED;
+    c->syn_ack_sent = now_us();
+    c->rtt.rto = SYN_RTO;
+    size_t len;
+    uint8_t *data = syn_data(pkt, &len);
+    if (len > 0 && store_data(&c->recv_buf, c->ack, data, len, false) > 0)
     {
-        return false; // buffer full
+        if (c->fec)
+            fec_received(c->fec_rx, c->ack, data, len, false);
+        c->ack = c->recv_buf.next;
+        c->stats.packets_received++;
     }
 
-    // Copy the complete packet (header + payload) into the next available slot.
-    buffer_entry_t *entry = &buf->entries[buf->tail];
-    memcpy(&entry->pkt, pkt, sizeof(packet) + payload_size);
-    entry->payload_len = payload_size;
-    entry->acked = false;
+    // Likewise our first packet of data, if there is any yet
+    if (has_input(c))
+    {
+        ssize_t n = input(next_payload(c), SYN_DATA);
+        if (n > 0)
+            add_data(c, n, ACK | (c->ext ? EXT : 0));
+    }
 
-    buf->total_payload += payload_size;
-    buf->count++;
-    buf->tail = (buf->tail + 1) % MAX_BUFFER_ENTRIES;
+    queue_syn_ack(w, c, false);
+    set_timer(c, true);
+}
+
+// Note data packet 'seq' going into the receiving buffer, 'stored' as
+// store_packet returns, with 'expected' the ACK before. Returns whether it
+// came in order.
+static bool on_stored(worker_t *w, conn_t *c, uint32_t seq, uint32_t expected, int stored)
+{
+    if (stored > 0 && seq_lt(expected, seq) && !seq_lt(seq, c->held_end))
+        c->held_end = seq + 1;
+    // Only the next packet with nothing held beyond it; a packet that
+    // fills a hole moves the ACK further
+    bool in_order = stored > 0 && seq == expected && c->recv_buf.next == expected + 1 &&
+                    !seq_lt(c->recv_buf.next, c->held_end);
+    if (!in_order)
+        c->quick_acks = QUICK_ACKS;
+    else if (c->quick_acks > 0)
+        c->quick_acks--;
+    c->ack = c->recv_buf.next;
+    if (c->ack_pending == 0)
+        c->ack_pending = w->rx_time;
+    return in_order;
+}
 
+// Rebuild the one packet missing from a repair packet's group, if only one
+// is, and store it as though it had arrived. Returns whether it did, and
+// sets '*in_order' as on_stored does.
+static bool on_repair(worker_t *w, conn_t *c, packet *pkt, bool *in_order)
+{
+    uint32_t expected = c->recv_buf.next;
+    uint32_t first = unwrap_seq(pkt, wire_seq(pkt), expected);
+    fec_header h = fec_header_of(pkt);
+    uint32_t seq;
+    bool lz;
+    long len = fec_rebuild(c->fec_rx, first, &h, packet_data(pkt), data_length(pkt), &seq, &lz);
+    if (len <= 0 || store_data(&c->recv_buf, seq, c->fec_rx->rebuilt, len, lz) <= 0)
+        return false;
+    fec_received(c->fec_rx, seq, c->fec_rx->rebuilt, len, lz);
+    c->stats.fec_rebuilt++;
+    *in_order = on_stored(w, c, seq, expected, 1);
     return true;
 }
 
-// Remove acknowledged packets from the front of the buffer to free up space.
-void remove_acked_packets(sending_buffer_t *buf)
+// Handle one datagram from the peer
+static void on_packet(worker_t *w, conn_t *c, packet *pkt)
+{
+    c->heard = w->rx_time;
+
+    // Another SYN means our SYN-ACK was lost, another SYN-ACK that our ACK
+    // to it was
+    if (pkt->flags & SYN)
+    {
+        if (!verify_packet(pkt))
+            return;
+        if (c->state == SYN_RECEIVED)
+        {
+            queue_syn_ack(w, c, true);
+        }
+        else if (pkt->flags & ACK)
+        {
+            queue_control(w, c, 0, ACK);
+        }
+        return;
+    }
+
+    // Data is verified as it is copied into the receiving buffer; nothing in
+    // a packet is trusted until it passes. A SACK payload is not data, nor is
+    // a loss report or a repair packet. A packet a repair rebuilds counts as
+    // data from here on.
+    bool sack = (pkt->flags & SACK) && c->sack;
+    bool loss_report = c->fec && (pkt->flags & (FEC | ACK)) == (FEC | ACK) && data_length(pkt) > 0;
+    bool repair = c->fec && (pkt->flags & (FEC | ACK)) == FEC;
+    bool data = data_length(pkt) > 0 && !sack && !loss_report && !repair;
+    bool in_order = false;
+    bool report = false;
+    c->stats.packets_received++;
+    if (data)
+    {
+        uint32_t seq = unwrap_seq(pkt, wire_seq(pkt), c->recv_buf.next);
+        uint32_t expected = c->recv_buf.next;
+        int stored = store_packet(&c->recv_buf, seq, pkt);
+        if (stored < 0)
+        {
+            c->stats.corrupt++;
+            return;
+        }
+        if (stored > 0 && c->fec)
+            report = fec_received(c->fec_rx, seq, packet_data(pkt), data_length(pkt), pkt->flags & LZ);
+        in_order = on_stored(w, c, seq, expected, stored);
+    }
+    else if (!verify_packet(pkt))
+    {
+        c->stats.corrupt++;
+        return;
+    }
+    else if (repair)
+    {
+        data = on_repair(w, c, pkt, &in_order);
+    }
+
+    // The first packet after our SYN-ACK completes the handshake and times
+    // the round trip, which a server with nothing to send has no other way
+    // to learn
+    if (c->state == SYN_RECEIVED)
+    {
+        if (c->syn_ack_sent > 0)
+        {
+            rtt_sample(&c->rtt, w->rx_time - c->syn_ack_sent);
+            hist_add(&c->stats.rtt, MAX(w->rx_time - c->syn_ack_sent, 0));
+        }
+        c->state = ESTABLISHED;
+        set_timer(c, c->send_buf.count > 0);
+    }
+    if (data)
+        autotune(c);
+
+    if (pkt->flags & ACK)
+    {
+        // Time the newest packet this ACK covers, unless it was resent, or
+        // the ACK fills a hole with a packet resent after it and so waited
+        // on that. Data sent along with the resend still times the round
+        // trip, without which a backed-off timeout would never come down.
+        uint32_t ack_num = unwrap_seq(pkt, wire_ack(pkt), c->last_ack);
+        int peer_window = ntohs(pkt->win) << c->peer_wscale;
+        buffer_entry_t *newest = find_packet(&c->send_buf, ack_num - 1);
+        buffer_entry_t *oldest = find_packet(&c->send_buf, c->send_buf.base);
+        bool hole_filled = oldest && oldest->retransmitted && seq_lt(c->send_buf.base, ack_num) && newest &&
+                           timercmp(&newest->sent, &oldest->resent, <);
+        long sent = newest ? newest->sent.tv_sec * 1000000L + newest->sent.tv_usec : 0;
+        if (newest && !newest->retransmitted && !hole_filled)
+        {
+            rtt_sample(&c->rtt, w->rx_time - sent);
+            hist_add(&c->stats.rtt, MAX(w->rx_time - sent, 0));
+        }
+
+        // Take the window from any ACK not older than the last; a changed
+        // window makes an ACK an update rather than a duplicate
+        bool window_update = false;
+        if (!seq_lt(ack_num, c->last_ack))
+        {
+            window_update = peer_window != c->peer_window;
+            c->peer_window = peer_window;
+        }
+
+        // A loss report comes ahead of any SACK bitmap
+        size_t head = loss_report ? 1 : 0;
+        if (loss_report)
+            fec_set_loss(c->fec_tx, packet_data(pkt)[0]);
+
+        int outstanding = c->send_buf.total_payload;
+        int released = acknowledge_packets(&c->send_buf, ack_num);
+        if (sack)
+        {
+            size_t bytes = data_length(pkt) - head;
+            sack_packets(&c->send_buf, ack_num, packet_data(pkt) + head, MIN(bytes, SACK_BYTES));
+        }
+
+        if (released > 0)
+        {
+            // The newest packet released was read from input when it was
+            // first sent, and is now in the peer's receiving buffer
+            c->stats.bytes_acked += outstanding - c->send_buf.total_payload;
+            if (newest)
+                hist_add(&c->stats.delivery, MAX(w->rx_time - sent, 0));
+
+            // A partial ACK during recovery means more was lost; resend it
+            // now rather than after a backed-off timeout. Fast recovery
+            // only ends with an ACK past 'recover' (NewReno).
+            int acked_bytes = outstanding - c->send_buf.total_payload;
+            c->recovering = c->recovering && seq_lt(ack_num, c->recover);
+            if (c->recovering)
+                retransmit_holes(w, c);
+            c->dup_acks = 0;
+            if (c->cc.recovering && c->recovering)
+                cc_partial_ack(&c->cc, acked_bytes);
+            else if (c->cc.recovering)
+                cc_recovered(&c->cc);
+            else
+                cc_ops()->on_ack(&c->cc, acked_bytes, now_us());
+            set_timer(c, c->send_buf.count > 0);
+        }
+        else if (ack_num == c->last_ack && c->send_buf.count > 0 && !data && !window_update)
+        {
+            // Third duplicate: fast retransmit without waiting for the timer
+            c->dup_acks++;
+            c->stats.dup_acks++;
+            if (w->trace)
+                trace_packet(w->trace, pkt, DUPS, c->addr.sin_port);
+            if (c->dup_acks == DUP_ACKS)
+            {
+                c->stats.fast_retransmits++;
+                start_recovery(w, c);
+                cc_ops()->on_fast_retransmit(&c->cc, now_us());
+            }
+            else if (c->dup_acks > DUP_ACKS)
+            {
+                // Later duplicates may SACK more, uncovering further holes
+                if (c->recovering && sack)
+                    retransmit_holes(w, c);
+                cc_dup_ack(&c->cc);
+            }
+        }
+        if (!seq_lt(ack_num, c->last_ack))
+            c->last_ack = ack_num;
+        update_window(c);
+        if (released > 0)
+            hist_add(&c->stats.window, c->window);
+        if (window_closed(c))
+            set_timer(c, true);
+    }
+
+    if (!data)
+        return;
+
+    // In-order data is ACKed every ACK_EVERY packets (ack_due, or the
+    // delayed ACK timer). Data we can send carries the ACK once the batch is
+    // in, so it is left to flush_acks. Anything else, duplicates and segments
+    // beyond the window included, is answered at once with a pure ACK: the
+    // sender counts duplicate ACKs to retransmit, and learns early that a
+    // hole was filled. So is data that brings a new FEC loss estimate, which
+    // only a pure ACK can carry.
+    c->unacked++;
+    if (!in_order || report)
+        queue_control(w, c, 0, ACK);
+    else if (!can_send_data(w, c))
+        ack_due(w, c, false);
+}
+
+// Handle one datagram of 'bytes' bytes from 'addr'
+static void on_datagram(worker_t *w, struct sockaddr_in *addr, char *data, size_t bytes)
 {
-    while (buf->count > 0 && buf->entries[buf->head].acked)
+    w->rx_packets++;
+    // Coalesced datagrams of odd size leave the ones after the first
+    // misaligned
+    if ((uintptr_t)data % _Alignof(packet) != 0)
     {
-        buf->total_payload -= buf->entries[buf->head].payload_len;
-        buf->head = (buf->head + 1) % MAX_BUFFER_ENTRIES;
-        buf->count--;
+        bytes = MIN(bytes, w->packet_size);
+        memcpy(w->scratch, data, bytes);
+        data = w->scratch;
     }
+
+    packet *pkt = (packet *)data;
+    // Drop runts and packets whose length field disagrees with the datagram:
+    // parity does not cover bytes past a length that was corrupted downwards
+    if (bytes < sizeof(packet) || bytes != sizeof(packet) + ntohs(pkt->length))
+        return;
+    if (w->trace)
+        trace_packet(w->trace, pkt, RECV, addr->sin_port);
+
+    conn_t *c = find_conn(w, addr);
+    if (c)
+        on_packet(w, c, pkt);
+    else if (pkt->flags & SYN)
+        on_syn(w, addr, pkt);
 }
 
-// Example function: mark packets as acknowledged based on an ACK number.
-// This is a simplified check assuming sequence numbers increase monotonically.
-void acknowledge_packets(sending_buffer_t *buf, uint16_t ack_number)
+// Size of the datagrams GRO coalesced into 'msg', or 0 if it holds one
+static size_t gro_segment(struct msghdr *msg)
 {
-    // Loop over the current entries and mark those with seq < ack_number as acknowledged.
-    for (int i = 0; i < buf->count; i++)
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
     {
-        int index = (buf->head + i) % MAX_BUFFER_ENTRIES;
-        uint16_t seq = ntohs(buf->entries[index].pkt.seq);
-        if (seq < ack_number)
-        { // You might need a more robust check for wrap-around.
-            buf->entries[index].acked = true;
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+        {
+            int segment;
+            memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+            return segment > 0 ? (size_t)segment : 0;
         }
     }
-    // Remove entries from the head that have been acknowledged.
-    remove_acked_packets(buf);
+    return 0;
 }
 
-int state = 0;         // Curr state
-int window = 0;        // Total num bytes in sending window
-int dup_acks = 0;      // Counting duplicate ACKs
-uint16_t ack = 0;      // ACK
-uint16_t seq = 0;      // Seq
-uint16_t last_ack = 0; // Last ack, keeps track of dupe ACKs
-bool force_ack = false;
-packet *base_pkt = NULL;
+// Drain every datagram queued on the socket, a batch per recvmmsg, splitting
+// what GRO coalesced back into its datagrams
+static void on_readable(worker_t *w)
+{
+    int n = BATCH_SIZE;
+    while (n == BATCH_SIZE)
+    {
+        for (int i = 0; i < BATCH_SIZE; i++)
+        {
+            w->recv_iov[i].iov_base = w->recv_buffers + i * w->recv_size;
+            w->recv_iov[i].iov_len = w->recv_size;
+            w->recv_msgs[i].msg_hdr = (struct msghdr){
+                .msg_name = &w->recv_addrs[i],
+                .msg_namelen = sizeof(w->recv_addrs[i]),
+                .msg_iov = &w->recv_iov[i],
+                .msg_iovlen = 1,
+                .msg_control = w->gro ? w->recv_control[i].buf : NULL,
+                .msg_controllen = w->gro ? sizeof(w->recv_control[i]) : 0,
+            };
+        }
 
-ssize_t (*input)(uint8_t *, size_t); // Get data from layer
-void (*output)(uint8_t *, size_t);   // Output data from layer
+        n = recvmmsg(w->sockfd, w->recv_msgs, BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+            break;
+        w->rx_time = now_us();
+        w->rx_calls++;
 
-#define CLIENT_WAIT 2 // Client is waiting for SYN ACK
-#define BEGIN 3       // Handshake finished, begin normal operations
+        for (int i = 0; i < n; i++)
+        {
+            char *data = w->recv_buffers + i * w->recv_size;
+            size_t bytes = w->recv_msgs[i].msg_len;
+            size_t segment = w->gro ? gro_segment(&w->recv_msgs[i].msg_hdr) : 0;
+            if (segment == 0)
+                segment = MAX(bytes, 1);
+            for (size_t offset = 0; offset < bytes; offset += segment)
+                on_datagram(w, &w->recv_addrs[i], data + offset, MIN(segment, bytes - offset));
+        }
 
-// Main function of transport layer; never quits
-void listen_loop(int sockfd, struct sockaddr_in *addr, int type,
-                 ssize_t (*input_p)(uint8_t *, size_t),
-                 void (*output_p)(uint8_t *, size_t))
+        // ACKs left for data to carry, and any still due
+        flush_acks(w, false);
+    }
+
+    bool held = false;
+    for (conn_t *c = w->conns; c; c = c->link)
+    {
+        deliver(w, c);
+        held = held || c->unacked > 0;
+    }
+    packet_flush(w);
+    if (held && !w->ack_armed)
+    {
+        struct itimerspec spec = {.it_value.tv_nsec = ACK_DELAY * 1000};
+        timerfd_settime(w->ack_fd, 0, &spec, NULL);
+        w->ack_armed = true;
+    }
+}
+
+// Fill a packet's payload from stdin through the LZ stage: with a block
+// standing for as much staged input as fits in the mss, or with raw input
+// when that would not be smaller. Returns the payload length, 0 if no input
+// is ready, and adds LZ to '*flags' for a block.
+static ssize_t input_lz(conn_t *c, uint8_t *payload, uint16_t *flags)
 {
+    if (!c->stage)
+        c->stage = calloc(1, sizeof(lz_stage_t));
+    lz_stage_t *s = c->stage;
 
-    int phase = type;
+    // While backing off, the stage is only drained; once it is empty, raw
+    // input goes straight into the payload rather than through it
+    if (s->skip > 0 && s->end == s->start)
+    {
+        ssize_t n = input(payload, c->mss);
+        if (n > 0)
+            s->skip--;
+        return MAX(n, 0);
+    }
 
-    char buffer[sizeof(packet) + MAX_PAYLOAD] = {0};
-    packet *pkt = (packet *)&buffer;
-    socklen_t addr_size = sizeof(struct sockaddr_in);
-    uint16_t server_seq = rand() % 1000;
-    uint16_t client_seq = rand() % 1000;
+    if (s->skip == 0 && s->end - s->start < LZ_BLOCK)
+    {
+        memmove(s->data, s->data + s->start, s->end - s->start);
+        s->end -= s->start;
+        s->start = 0;
+        ssize_t n;
+        while (s->end < LZ_STAGE && (n = input(s->data + s->end, LZ_STAGE - s->end)) > 0)
+            s->end += n;
+    }
+    size_t waiting = s->end - s->start;
+    if (waiting == 0)
+        return 0;
 
-    sending_buffer_t send_buf;
-    init_sending_buffer(&send_buf);
+    if (s->skip == 0)
+    {
+        size_t consumed;
+        size_t len = lz_compress(&s->encoder, s->data + s->start, waiting, payload, c->mss, &consumed);
+        if (len < consumed)
+        {
+            s->backoff = LZ_BACKOFF;
+            s->start += consumed;
+            c->stats.lz_input += consumed;
+            c->stats.lz_output += len;
+            *flags |= LZ;
+            return len;
+        }
+        s->skip = MAX(s->backoff, LZ_BACKOFF);
+        s->backoff = MIN(s->skip * 2, LZ_BACKOFF_MAX);
+    }
+    else
+    {
+        s->skip--;
+    }
+
+    size_t len = MIN(waiting, (size_t)c->mss);
+    memcpy(payload, s->data + s->start, len);
+    s->start += len;
+    return len;
+}
+
+// Hold back the connection until the pacer's timer fires 'delay' usec from now
+static void pace(worker_t *w, conn_t *c, long delay)
+{
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = delay / 1000000;
+    spec.it_value.tv_nsec = (delay % 1000000) * 1000;
+    timerfd_settime(w->pace_fd, 0, &spec, NULL);
+    w->paced = c;
+}
+
+// Add data packet 'seq' to its FEC group, and queue the group's repair
+// packet at 'time' once that completes it
+static void fec_send(worker_t *w, conn_t *c, uint32_t seq, const uint8_t *data, size_t len, bool lz, long time)
+{
+    size_t repair_len;
+    packet *repair = fec_encode(c->fec_tx, seq, data, len, lz, &repair_len);
+    if (!repair)
+        return;
+    size_t ext = c->ext ? sizeof(packet_ext) : 0;
+    packet_create(repair, c->fec_tx->first, c->fec_tx->group.len, repair_len, fec_win(&c->fec_tx->group),
+                  FEC | (c->ext ? EXT : 0), NULL);
+    seal_packet(repair);
+    pacer_spend(&c->pacer, sizeof(packet) + ext + repair_len);
+    packet_queue_at(w, &c->addr, repair, time);
+    c->stats.fec_repairs++;
+}
+
+// Packetize stdin, through the LZ stage if negotiated, until the window is
+// full, no input is ready or, with -P,
+// the pacer holds the next packet back. With SO_TXTIME the pacer lets packets
+// out up to a PACE_QUANTUM early, stamped with when they are due.
+static void on_input(worker_t *w, conn_t *c)
+{
+    size_t ext = c->ext ? sizeof(packet_ext) : 0;
+    long now = options.pacing ? now_us() : 0;
+    long lead = w->txtime ? PACE_QUANTUM : 0;
+    if (options.pacing && c->rtt.sampled)
+        pacer_set_rate(&c->pacer, c->cc.cwnd, c->rtt.srtt, c->cc.cwnd < c->cc.ssthresh, c->mss);
+
+    // A grown window may need a larger ring, which moves the entries that
+    // queued packets point into
+    packet_flush(w);
+    grow_sending_buffer(&c->send_buf, c->send_buf.window);
+
+    while (can_send_packet(&c->send_buf, c->mss))
+    {
+        long delay = options.pacing ? pacer_delay(&c->pacer, sizeof(packet) + ext + c->mss, now) : 0;
+        if (delay > lead)
+        {
+            pace(w, c, delay - lead);
+            break;
+        }
+
+        // Input goes straight into the packet's slot in the sending buffer
+        uint16_t flags = ACK | (c->ext ? EXT : 0);
+        uint8_t *payload = next_payload(c);
+        ssize_t bytes_read = c->lz ? input_lz(c, payload, &flags) : input(payload, c->mss);
+        if (bytes_read <= 0)
+            break;
+
+        // Each packet carries the current ACK, which makes a pure one for
+        // what arrived since unnecessary
+        if (c->unacked > 0)
+        {
+            c->stats.acks_piggybacked++;
+            acked(c, false);
+        }
+        uint32_t seq = c->seq;
+        buffer_entry_t *entry = add_data(c, (size_t)bytes_read, flags);
+        if (c->send_buf.count == 1)
+            set_timer(c, true);
+        pacer_spend(&c->pacer, sizeof(packet) + ext + bytes_read);
+        long time = delay > 0 ? monotonic_ns() + delay * 1000 : 0;
+        packet_queue_at(w, &c->addr, entry->pkt, time);
+        if (c->fec)
+            fec_send(w, c, seq, payload, (size_t)bytes_read, flags & LZ, time);
+    }
+    packet_flush(w);
+}
+
+static void on_dump_signal(int signum)
+{
+    (void)signum;
+    dump_requested = 1;
+}
+
+static void on_stop_signal(int signum)
+{
+    (void)signum;
+    atomic_store(&stop_requested, true);
+}
+
+// Dump a worker's counters and every connection's state, counters and
+// histograms to stderr as one line of JSON, written at once
+static void print_stats(worker_t *w, int id)
+{
+    char *json;
+    size_t size;
+    FILE *out = open_memstream(&json, &size);
+    if (!out)
+        return;
+
+    fprintf(out, "{\"worker\":%d,\"gso\":%s,\"gro\":%s,\"txtime\":%s,\"tx_packets\":%lu,"
+                 "\"tx_calls\":%lu,\"rx_packets\":%lu,\"rx_calls\":%lu,\"connections\":[",
+            id, w->gso ? "true" : "false", w->gro ? "true" : "false", w->txtime ? "true" : "false",
+            w->tx_packets, w->tx_calls, w->rx_packets, w->rx_calls);
+    for (conn_t *c = w->conns; c; c = c->link)
+    {
+        char host[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &c->addr.sin_addr, host, sizeof(host));
+        fprintf(out, "%s{\"peer\":\"%s:%hu\",\"state\":\"%s\",\"sack\":%s,\"lz\":%s,\"fec\":%s,", c == w->conns ? "" : ",",
+                host, ntohs(c->addr.sin_port), c->state == ESTABLISHED ? "established" : "syn_received",
+                c->sack ? "true" : "false", c->lz ? "true" : "false",
+                c->fec ? "true" : "false");
+        fprintf(out, "\"srtt_us\":%ld,\"rttvar_us\":%ld,\"rto_us\":%ld,", c->rtt.srtt, c->rtt.rttvar,
+                c->rtt.rto);
+        fprintf(out, "\"mss\":%d,\"cc\":\"%s\",\"cwnd\":%d,\"ssthresh\":%d,\"window\":%d,\"in_flight\":%d,",
+                c->mss, cc_ops()->name, c->cc.cwnd, c->cc.ssthresh, c->window, c->send_buf.total_payload);
+        fprintf(out, "\"peer_window\":%d,\"advertised_window\":%d,\"receive_buffer\":%d,",
+                c->peer_window, c->adv_window, c->recv_buf.window);
+        fprintf(out, "\"pacing_rate\":%.0f,", c->pacer.rate * 1000000);
+        fprint_stats_json(out, &c->stats);
+        fprintf(out, "}");
+    }
+    fprintf(out, "]}\n");
+    fclose(out);
+    fputs(json, stderr);
+    free(json);
+}
+
+static worker_t *new_worker(int sockfd, int max_conns)
+{
+    worker_t *w = calloc(1, sizeof(worker_t));
+    w->sockfd = sockfd;
+    w->max_conns = max_conns;
+    w->seed = rand();
+    w->trace = trace_new();
+    w->wake_fd = -1;
+    w->ack_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    w->pace_fd = options.pacing ? timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK) : -1;
+    w->packet_size = sizeof(packet) + sizeof(packet_ext) + options.mss;
+    w->scratch = malloc(w->packet_size);
+
+    // Kernels without UDP segmentation offload know neither option
+    int on = 1, segment;
+    socklen_t len = sizeof(segment);
+    w->gso = options.offload && getsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &segment, &len) == 0;
+    w->gro = options.offload && setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+    w->recv_size = w->gro ? MAX(w->packet_size, GRO_BUFFER) : w->packet_size;
+    w->recv_buffers = malloc(BATCH_SIZE * w->recv_size);
+
+    // Departure times only hold packets back under the fq or etf qdisc;
+    // elsewhere they leave at once, up to a PACE_QUANTUM early
+    struct sock_txtime txtime = {.clockid = CLOCK_MONOTONIC};
+    w->txtime = options.pacing && setsockopt(sockfd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0;
+
+    // A window of large packets, or of GSO runs, overflows the default socket
+    // buffers
+    if (options.mss > MAX_PAYLOAD || w->gso)
+    {
+        int size = SOCKET_BUFFER;
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+
+    int flags = fcntl(sockfd, F_GETFL);
+    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+    return w;
+}
+
+// A worker's event loop; returns once stop_requested is set, or once stdout
+// has failed and nothing can be delivered any more
+static void *worker_loop(void *arg)
+{
+    worker_t *w = arg;
+
+    // Fixed slots first, then one retransmission timer per connection
+    enum { SOCK_FD, INPUT_FD, OUTPUT_FD, WAKE_FD, PACE_FD, ACK_FD, FIRST_TIMER_FD };
+    int capacity = FIRST_TIMER_FD + 1;
+    struct pollfd *fds = malloc(capacity * sizeof(struct pollfd));
+    conn_t **timer_conns = malloc(capacity * sizeof(conn_t *));
 
     while (true)
     {
-        if (phase == CLIENT)
+        if (FIRST_TIMER_FD + w->conn_count > capacity)
         {
-            int index = 0;
-            while (true)
+            capacity = 2 * (FIRST_TIMER_FD + w->conn_count);
+            fds = realloc(fds, capacity * sizeof(struct pollfd));
+            timer_conns = realloc(timer_conns, capacity * sizeof(conn_t *));
+        }
+
+        // Only wait on stdin while there is window to put its data in and
+        // nothing read ahead to use first, and on stdout while there is
+        // output queued behind it (poll skips negative descriptors)
+        conn_t *sender = NULL;
+        bool buffered = false;
+        fds[SOCK_FD] = (struct pollfd){.fd = w->sockfd, .events = POLLIN};
+        fds[INPUT_FD] = (struct pollfd){.fd = -1, .events = POLLIN};
+        fds[OUTPUT_FD] = (struct pollfd){.fd = -1, .events = output_events()};
+        fds[WAKE_FD] = (struct pollfd){.fd = w->wake_fd, .events = POLLIN};
+        fds[PACE_FD] = (struct pollfd){.fd = w->pace_fd, .events = POLLIN};
+        fds[ACK_FD] = (struct pollfd){.fd = w->ack_fd, .events = POLLIN};
+        int nfds = FIRST_TIMER_FD;
+        for (conn_t *c = w->conns; c; c = c->link)
+        {
+            if (can_send_data(w, c))
             {
-                char buffer[sizeof(packet) + MAX_PAYLOAD] = {0};
-                packet *pkt = (packet *)&buffer;
-                pkt->seq = htons(client_seq + index);
-                pkt->ack = htons(0);
-                pkt->flags = SYN;
-                pkt->win = htons(MAX_PAYLOAD);
-                ssize_t input_len = input_p(pkt->payload, MAX_PAYLOAD);
-                pkt->length = htons(input_len); // Store actual data length
-                // Send SYN (with potential payload)
-
-                if (!add_packet(&send_buf, pkt, (size_t)input_len))
-                {
-                    // Wait for ack packets.
-                    char ack_buffer[sizeof(packet) + MAX_PAYLOAD] = {0};
-                    packet *ack_pkt = (packet *)&ack_buffer;
-
-                    recvfrom(sockfd, ack_pkt, sizeof(packet) + MAX_PAYLOAD, 0,
-                             (struct sockaddr *)addr, &addr_size);
-                    acknowledge_packets(&send_buf, ntohs(ack_pkt->ack));
-                }
-
-                sendto(sockfd, pkt, sizeof(packet) + input_len, 0,
-                       (struct sockaddr *)addr, sizeof(struct sockaddr_in));
-
-                index++;
+                sender = c;
+                buffered = input_buffered() > 0 || staged(c) > 0;
+                fds[INPUT_FD].fd = buffered ? -1 : input_fd();
             }
+            timer_conns[nfds] = c;
+            fds[nfds++] = (struct pollfd){.fd = c->timer_fd, .events = POLLIN};
         }
-        else if (phase == SERVER)
+        if (output_pending() > 0)
+            fds[OUTPUT_FD].fd = output_fd();
+
+        if (dump_requested)
         {
-            uint16_t seq = 0;
-            recvfrom(sockfd, pkt, sizeof(packet) + MAX_PAYLOAD, 0, (struct sockaddr *)addr, &addr_size);
-            if (pkt->flags == SYN)
+            dump_requested = 0;
+            print_stats(w, 0);
+            if (w->trace)
+                trace_flush(w->trace);
+        }
+        if (atomic_load(&stop_requested) || output_failed())
+            break;
+
+        if (poll(fds, nfds, buffered ? 0 : -1) < 0)
+            continue;
+
+        for (int i = FIRST_TIMER_FD; i < nfds; i++)
+        {
+            if (fds[i].revents & POLLIN)
+                on_timeout(w, timer_conns[i]);
+        }
+        if (fds[WAKE_FD].revents & POLLIN)
+        {
+            // The connections are this thread's, so it prints them itself
+            uint64_t requests;
+            if (read(w->wake_fd, &requests, sizeof(requests)) > 0 && w->trace)
+                trace_flush(w->trace);
+            if (atomic_exchange(&w->dump, false))
+                print_stats(w, w->id);
+        }
+        if (fds[ACK_FD].revents & POLLIN)
+        {
+            // The delayed ACK timer: whatever is still held back has waited
+            // long enough
+            uint64_t expirations;
+            w->ack_armed = false;
+            if (read(w->ack_fd, &expirations, sizeof(expirations)) > 0)
             {
-                seq = ntohs(pkt->seq);
+                flush_acks(w, true);
+                packet_flush(w);
             }
-            // If payload
-            if (pkt->length > 0)
+        }
+        if (fds[SOCK_FD].revents & POLLIN)
+            on_readable(w);
+        if (fds[PACE_FD].revents & POLLIN)
+        {
+            uint64_t expirations;
+            conn_t *c = w->paced;
+            w->paced = NULL;
+            if (read(w->pace_fd, &expirations, sizeof(expirations)) > 0 && c && c != sender)
+                on_input(w, c);
+        }
+        // An error or a closed descriptor reads as end of file, like a hangup
+        if (sender && (buffered || (fds[INPUT_FD].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))))
+            on_input(w, sender);
+
+        // Everything delivered this round goes out in one write
+        if (output_pending() > 0)
+        {
+            flush_io();
+            for (conn_t *c = w->conns; c; c = c->link)
             {
-                output_p(pkt->payload, ntohs(pkt->length));
+                if (c->stdio)
+                    deliver(w, c);
             }
-            // Send SYN-ACK with possible payload
-            pkt->seq = htons(server_seq);
-            pkt->ack = htons(seq + 1);
-            pkt->flags = SYN | ACK;
-            pkt->win = htons(MAX_PAYLOAD);
-            ssize_t input_len = input_p(pkt->payload, MAX_PAYLOAD);
-            pkt->length = htons(input_len);
-
-            sendto(sockfd, pkt, sizeof(packet) + input_len, 0, (struct sockaddr *)addr, sizeof(struct sockaddr_in));
-            phase = BEGIN;
-        }
-        else if (phase == CLIENT_WAIT)
-        {
-            // receive packet from server
-            uint16_t seq = 0;
-            recvfrom(sockfd, pkt, sizeof(packet) + MAX_PAYLOAD, 0, (struct sockaddr *)addr, &addr_size);
-            if (pkt->length > 0)
+            packet_flush(w);
+        }
+    }
+
+    free(fds);
+    free(timer_conns);
+    if (w->trace)
+        trace_flush(w->trace);
+    return NULL;
+}
+
+int parse_options(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "c:kM:m:t:w:EGPSTfz")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            if (!select_cc(optarg))
             {
-                seq = ntohs(pkt->seq);
-                output_p(pkt->payload, ntohs(pkt->length));
+                fprintf(stderr, "Unknown congestion control '%s'\n", optarg);
+                return -1;
             }
-            // Send SYN-ACK with possible payload
-            pkt->seq = htons(server_seq);
-            pkt->ack = htons(seq + 1);
-            pkt->flags = ACK;
-
-            ssize_t input_len = input_p(pkt->payload, MAX_PAYLOAD);
-            if (input_len > 0)
+            break;
+        case 'k':
+            enable_crc();
+            break;
+        case 'm':
+            options.output_dir = optarg;
+            break;
+        case 'M':
+            options.mss = atoi(optarg);
+            if (options.mss < MAX_PAYLOAD || options.mss > MSS_MAX)
             {
-                client_seq += 1;
-                pkt->seq = client_seq;
+                fprintf(stderr, "The MSS must be between %d and %d bytes\n", MAX_PAYLOAD, MSS_MAX);
+                return -1;
             }
-            else
+            break;
+        case 'E':
+            options.ext = false;
+            break;
+        case 'G':
+            options.offload = false;
+            break;
+        case 'P':
+            options.pacing = true;
+            break;
+        case 'S':
+            options.sack = false;
+            break;
+        case 'T':
+            options.io_threads = true;
+            break;
+        case 'f':
+            options.fec = true;
+            break;
+        case 'z':
+            options.lz = true;
+            break;
+        case 't':
+            if (!trace_open(optarg))
             {
-                pkt->seq = 0;
+                perror(optarg);
+                return -1;
             }
-            pkt->length = htons(input_len);
-            sendto(sockfd, pkt, sizeof(packet) + input_len, 0, (struct sockaddr *)addr, sizeof(struct sockaddr_in));
-            phase = BEGIN;
+            break;
+        case 'w':
+            options.workers = atoi(optarg);
+            if (options.workers < 1)
+                return -1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return optind;
+}
+
+// Main function of transport layer; returns on SIGINT or SIGTERM
+void listen_loop(int sockfd, struct sockaddr_in *addr, int type,
+                 ssize_t (*input_p)(uint8_t *, size_t),
+                 size_t (*output_p)(uint8_t *, size_t))
+{
+    input = input_p;
+    output = output_p;
+
+    // No SA_RESTART, so the signals wake poll() to print the counters or to
+    // stop, printing them a last time
+    struct sigaction sa = {.sa_handler = on_dump_signal};
+    sigaction(SIGUSR1, &sa, NULL);
+    struct sigaction stop = {.sa_handler = on_stop_signal};
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    // The first packet of data, if stdin already has it, goes in the SYN
+    uint32_t client_seq = rand() % 1000;
+    char syn_ack_buffer[MAX_PACKET];
+    packet *syn_ack = (packet *)&syn_ack_buffer;
+    uint8_t first[SYN_DATA];
+    ssize_t first_len = type == CLIENT ? input(first, sizeof(first)) : 0;
+    first_len = MAX(first_len, 0);
+    long syn_rtt = type == CLIENT ? handshake(sockfd, addr, client_seq, first, first_len, syn_ack) : 0;
+    if (syn_rtt < 0)
+    {
+        fprintf(stderr, "Handshake failed\n");
+        return;
+    }
+
+    // The socket turns non-blocking here, after the blocking handshake. The
+    // server's one connection is set up by the first SYN to arrive.
+    worker_t *w = new_worker(sockfd, 1);
+    if (type == CLIENT)
+    {
+        conn_t *c = add_conn(w, addr, client_seq + 1, wire_seq(syn_ack) + 1, syn_ack);
+        if (!c)
+            return;
+        c->state = ESTABLISHED;
+        c->stdio = true;
+        if (syn_rtt > 0)
+        {
+            rtt_sample(&c->rtt, syn_rtt);
+            hist_add(&c->stats.rtt, syn_rtt);
+        }
+
+        // The SYN-ACK's own data, then its ACK of ours; what it did not
+        // acknowledge goes out again right away
+        size_t len;
+        uint8_t *data = syn_data(syn_ack, &len);
+        if (len > 0 && store_data(&c->recv_buf, c->ack, data, len, false) > 0)
+        {
+            if (c->fec)
+                fec_received(c->fec_rx, c->ack, data, len, false);
+            c->ack = c->recv_buf.next;
+            c->stats.packets_received++;
+        }
+        if (first_len > 0)
+        {
+            buffer_entry_t *entry = add_syn_data(c, first, first_len);
+            entry->retransmitted = syn_rtt == 0;
+            entry->resent = entry->sent;
+            uint32_t ack_num = unwrap_seq(syn_ack, wire_ack(syn_ack), c->seq);
+            if (acknowledge_packets(&c->send_buf, ack_num) > 0)
+                c->stats.bytes_acked += first_len;
+            else
+                retransmit(w, c, entry);
+            set_timer(c, c->send_buf.count > 0);
+        }
+        queue_control(w, c, 0, ACK);
+        deliver(w, c);
+        packet_flush(w);
+    }
+
+    worker_loop(w);
+    print_stats(w, 0);
+}
+
+void serve_loop(int port, int workers)
+{
+    // Workers inherit the blocked signals; only this thread takes them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    struct sockaddr_in server_addr = {0};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    // Each connection holds a timer and, with -m, its output file open
+    struct rlimit files;
+    int max_conns = MAX_CONNS;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY)
+        max_conns = MIN(max_conns, MAX(((int)files.rlim_cur - RESERVED_FDS) / 2 / workers, 1));
+
+    // A socket per worker on the same port. The kernel hashes each peer's
+    // address onto one of them, so a connection always stays on one worker
+    // and the workers share nothing.
+    worker_t **pool = calloc(workers, sizeof(worker_t *));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+    for (int i = 0; i < workers; i++)
+    {
+        int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        int one = 1;
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+        {
+            perror("bind");
+            exit(1);
+        }
+
+        pool[i] = new_worker(sockfd, max_conns);
+        pool[i]->id = i;
+        pool[i]->wake_fd = eventfd(0, EFD_NONBLOCK);
+        pthread_create(&threads[i], NULL, worker_loop, pool[i]);
+    }
+
+    // Connections and trace rings belong to their workers, so each is asked
+    // to print its counters and flush its trace itself
+    int signum = 0;
+    while (signum != SIGINT && signum != SIGTERM)
+    {
+        sigwait(&signals, &signum);
+        if (signum == SIGUSR1)
+        {
+            for (int i = 0; i < workers; i++)
+                atomic_store(&pool[i]->dump, true);
         }
-        // Normal Operations
         else
         {
-            recvfrom(sockfd, pkt, sizeof(packet) + MAX_PAYLOAD, 0, (struct sockaddr *)addr, &addr_size);
+            atomic_store(&stop_requested, true);
         }
+
+        uint64_t one = 1;
+        for (int i = 0; i < workers; i++)
+        {
+            if (write(pool[i]->wake_fd, &one, sizeof(one)) < 0)
+                perror("eventfd");
+        }
+    }
+
+    // The workers have flushed their traces; the final counters are settled
+    for (int i = 0; i < workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+        print_stats(pool[i], i);
     }
-}
\ No newline at end of file
+}
@@ -1,9 +1,69 @@
 #pragma once
 
+#include <netinet/in.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
 
-// Main function of transport layer; never quits
+// Settings taken from the command line that are not handled on the spot
+typedef struct {
+    const char* output_dir; // Server: one output file per client, in here
+    int workers;            // Server: threads sharing the port, with -m
+    bool sack;              // Offer and accept selective acknowledgments
+    bool ext;               // Offer and accept 32-bit seq/ack and window scaling
+    int mss;                // Largest payload per packet to offer (needs ext)
+    bool offload;           // Use UDP segmentation/receive offload if the kernel has it
+    bool pacing;            // Space data packets out over the RTT
+    bool lz;                // Offer and accept LZ compression of the data
+    bool io_threads;        // Read stdin and write stdout on threads of their own
+    bool fec;               // Offer and accept forward error correction
+} options_t;
+
+extern options_t options;
+
+// Command-line flags shared by client and server, given before the
+// positional arguments:
+//   -c <algorithm>  congestion control, "reno" (default) or "cubic"
+//   -k              carry a CRC32C in every packet sent
+//   -S              do not negotiate selective acknowledgments (SACK)
+//   -E              do not negotiate the header extension (EXT) that widens
+//                   seq/ack to 32 bits and scales the window past 64 KB
+//   -G              do not hand the kernel runs of packets to split (GSO) or
+//                   take coalesced ones from it (GRO); both fall back on
+//                   their own on kernels without them
+//   -P              pace data at about cwnd/SRTT instead of sending each
+//                   window in a burst; departure times go to the kernel with
+//                   SO_TXTIME where it takes them
+//   -M <bytes>      offer packets with up to this much payload, e.g. 65000
+//                   on loopback or 8952 on a 9000-byte MTU path; both ends
+//                   use the smaller offer, and 1012 without EXT (default 1012)
+//   -z              offer to compress data with a built-in LZ codec; when both
+//                   ends do, each packet carries as much input as compresses
+//                   into it, or raw input where that is no smaller
+//   -f              offer forward error correction; when both ends do, the
+//                   sender follows groups of data packets with XOR repair
+//                   packets that let the receiver rebuild one lost packet per
+//                   group without a resend, more often the more it sees lost
+//   -T              read stdin and write stdout on two threads of their own,
+//                   handing data over through lock-free rings, so that a
+//                   slow pipe at either end never holds up the network loop
+//   -t <file>       record a binary trace of every packet sent and received
+//                   into <file>, flushed when full and on SIGUSR1; read it
+//                   with tracedump
+//   -m <dir>        server: accept any number of clients, writing each one's
+//                   data to <dir>/<address>-<port> instead of stdout
+//   -w <n>          server with -m: n worker threads (default 1)
+// Returns the index of the first positional argument, or -1 on a bad flag
+int parse_options(int argc, char** argv);
+
+// Main function of transport layer. SIGUSR1 dumps its counters to stderr
+// as a line of JSON; SIGINT and SIGTERM make it dump them once more and
+// return.
 void listen_loop(int sockfd, struct sockaddr_in* addr, int type,
                  ssize_t (*input_p)(uint8_t*, size_t),
-                 void (*output_p)(uint8_t*, size_t));
+                 size_t (*output_p)(uint8_t*, size_t));
+
+// Multi-client server: 'workers' threads, each with its own SO_REUSEPORT
+// socket bound to 'port', writing into options.output_dir. Signals are
+// handled as in listen_loop, with one line of JSON per worker.
+void serve_loop(int port, int workers);